@@ -203,6 +203,22 @@ inline int connect(int fd, const sockaddr *addr, socklen_t len) {
 
         ret = ::connect(fd, addr, len);
 
+        // AF_UNIX connects (or fails) at once
+        if(ret == 0) return 0;
+        switch(errno) {
+            case EINTR:
+            case EINPROGRESS:
+            case EALREADY:
+            case EAGAIN:
+            case EADDRINUSE:
+            case EADDRNOTAVAIL:
+            case ENETUNREACH:
+            case ECONNREFUSED:
+                break;
+            default:
+                return -1;
+        }
+
         auto &poll = getPollConfig();
         auto iter = addEvent(fd, Event::Type::WRITE);
         if(iter == poll.events.end()) {
@@ -1,5 +1,7 @@
 #ifndef __VS_JSON__
 #define __VS_JSON__
+#include "vsjson/Arena.h"
 #include "vsjson/Json.h"
 #include "vsjson/Parser.h"
+#include "vsjson/Lazy.h"
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef __JSON_ARENA_H__
+#define __JSON_ARENA_H__
+#include <bits/stdc++.h>
+#include "internal/Allocator.h"
+namespace vsjson {
+
+// monotonic arena for short-lived json trees
+//
+// usage:
+//     Arena arena;
+//     Json json = parse(text, arena.resource());
+//     ...
+//     // destroy every json allocated from arena first
+//     arena.reset();
+//
+// allocation is a pointer bump, deallocation is a no-op
+// the first block is owned by arena and reused after reset()
+//
+// Note: a tree moved out of arena still points to arena memory,
+//       copy it if it should outlive the next reset()
+class Arena {
+public:
+    constexpr static size_t DEFAULT_BLOCK_SIZE = 1 << 12;
+
+public:
+    explicit Arena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    Resource* resource() { return &_monotonic; }
+
+    // release all the memory allocated since last reset
+    // blocks beyond the first one are returned to upstream
+    void reset() { _monotonic.release(); }
+
+private:
+    std::unique_ptr<char[]> _block;
+    std::pmr::monotonic_buffer_resource _monotonic;
+};
+
+inline Arena::Arena(size_t blockSize)
+    : _block(new char[blockSize]),
+      _monotonic(_block.get(), blockSize, std::pmr::new_delete_resource())
+{}
+
+} // vsjson
+#endif
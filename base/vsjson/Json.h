@@ -18,6 +18,9 @@ public:
     template <size_t N>
     Json(const char (&str)[N]): _value(StringImpl(str)) {}
     Json(bool b): _value(BooleanImpl(b)) {}
+    // signed -> IntegerImpl, unsigned -> UnsignedImpl, floating point -> DecimalImpl
+    template <typename T, typename = detail::RequireNumber<T>>
+    Json(T number): _value(static_cast<detail::NumberStorage<T>>(number)) {}
     Json(nullptr_t): _value(NullImpl(nullptr)) {}
     Json(const std::string &str): _value(StringImpl(str)) {}
     Json(std::string &&str): _value(StringImpl(static_cast<std::string&&>(str))) {}
@@ -25,6 +28,7 @@ public:
     Json(std::initializer_list<ObjectImpl::value_type> &&list): _value(ObjectImpl(std::move(list))) {}
 
     Json(const Json &rhs): _value(rhs._value) {}
+    Json(Json &rhs): _value(rhs._value) {}
     Json(Json &&rhs): _value(std::move(rhs._value)) {}
 
     template <typename T,
@@ -40,13 +44,15 @@ public:
     Json& operator=(std::string &&str);
 
     template <typename T> bool is() const { return _value.is<T>(); }
-    template <typename T> T& as() { return _value.get<T>(); }
+    template <typename T> typename detail::As<T>::Type as() { return _value.get<T>(); }
+    // a number converted to an integer type is range checked (std::out_of_range)
     template <typename T> T to() const & { return _value.to<T>(); }
     template <typename T> T to() && { return std::move(_value).to<T>(); }
 
-    bool contains(const StringImpl &index) const;
+    bool contains(std::string_view index) const;
 
-    Json& operator[](const StringImpl &index);
+    // a missing key is inserted with the allocator of this object
+    Json& operator[](std::string_view index);
     Json& operator[](size_t index);
     const Json& operator[](size_t index) const;
 
@@ -62,6 +68,8 @@ public:
     std::string dump();
     template <typename ...Specifieds>
     std::string dump(Specifieds &&...ses);
+    // append the text to `out`, nothing is allocated if its capacity is enough
+    void dumpTo(std::string &out);
 
     // FIXME: use swap on operator=
     void swap(Json &rhs) { std::swap(*this, rhs); }
@@ -80,21 +88,20 @@ inline JsonValue Json::array(Args &&...elems) {
 
 template <typename T,typename>
 inline Json& Json::operator=(T&& obj) {
-    this->~Json();
-    _value = std::forward<T>(obj);
+    // convert by constructor first, e.g. int -> IntegerImpl
+    Json json(std::forward<T>(obj));
+    _value = std::move(json._value);
     return *this;
 }
 
 inline Json& Json::operator=(const Json &rhs) {
     if(this == &rhs) return *this;
-    this->~Json();
     _value = rhs._value;
     return *this;
 }
 
 inline Json& Json::operator=(Json &&rhs) {
     if(this == &rhs) return *this;
-    this->~Json();
     _value = std::move(rhs._value);
     return *this;
 }
@@ -125,12 +132,19 @@ inline Json& Json::operator=(std::string &&str) {
     return *this;
 }
 
-inline bool Json::contains(const StringImpl &index) const {
-    return _value.get<ObjectImpl>().count(index);
+inline bool Json::contains(std::string_view index) const {
+    auto &object = _value.get<ObjectImpl>();
+    return object.find(index) != object.end();
 }
 
-inline Json& Json::operator[](const StringImpl &index) {
-    return _value.get<ObjectImpl>()[index];
+inline Json& Json::operator[](std::string_view index) {
+    auto &object = _value.get<ObjectImpl>();
+    auto iter = object.find(index);
+    if(iter != object.end()) {
+        return iter->second;
+    }
+    detail::String key(index, object.get_allocator());
+    return object.try_emplace(std::move(key)).first->second;
 }
 inline Json& Json::operator[](size_t index) {
     return _value.get<ArrayImpl>()[index];
@@ -177,6 +191,37 @@ inline std::string Json::dump(Specifieds &&...ses) {
     return ss.str();
 }
 
+namespace detail {
+
+// appends to a std::string, unlike std::stringbuf it has no buffer of its own
+class AppendBuf: public std::streambuf {
+public:
+    explicit AppendBuf(std::string &out): _out(out) {}
+
+protected:
+    int_type overflow(int_type ch) override {
+        if(!traits_type::eq_int_type(ch, traits_type::eof())) {
+            _out.push_back(traits_type::to_char_type(ch));
+        }
+        return ch;
+    }
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        _out.append(s, n);
+        return n;
+    }
+
+private:
+    std::string &_out;
+};
+
+} // detail
+
+inline void Json::dumpTo(std::string &out) {
+    detail::AppendBuf buf(out);
+    std::ostream os(&buf);
+    os << (*this);
+}
+
 /// specialization
 
 template <>
@@ -186,10 +231,26 @@ template <>
 inline bool Json::is<nullptr_t>() const { return _value.is<NullImpl>(); }
 
 template <>
-inline bool Json::is<std::string>() const { return _value.is<StringImpl>(); }
+inline bool Json::is<std::string>() const {
+    return _value.is<StringImpl>() || _value.is<StringViewImpl>();
+}
+
+// a mutable string is required, materialize the view in place
+template <>
+inline StringImpl& Json::as<StringImpl>() {
+    if(_value.is<StringViewImpl>()) {
+        StringImpl str(_value.get<StringViewImpl>());
+        _value = std::move(str);
+    }
+    return _value.get<StringImpl>();
+}
 
+// a copy of either a string or a view, see detail::As
 template <>
-inline std::string& Json::as<std::string>()  { return _value.get<StringImpl>(); }
+inline std::string Json::as<std::string>() {
+    if(_value.is<StringViewImpl>()) return _value.get<StringViewImpl>();
+    return _value.get<StringImpl>();
+}
 
 inline std::ostream& operator<<(std::ostream &os, ArrayImpl &vec) {
     os << '[';
@@ -206,7 +267,9 @@ inline std::ostream& operator<<(std::ostream &os, ArrayImpl &vec) {
 inline std::ostream& operator<<(std::ostream &os, ObjectImpl &map) {
     os << '{';
     for(auto iter = map.begin(); iter != map.end(); ++iter) {
-        os << '\"' << iter->first << "\":" << iter->second;
+        os << '\"';
+        detail::writeEscaped(os, iter->first);
+        os << "\":" << iter->second;
         if(std::distance(iter, map.end()) > 1) {
             os << ',';
         }
@@ -2,15 +2,26 @@
 #define __JSON_JSON_VALUE_H__
 #include <bits/stdc++.h>
 #include "internal/TypeCompat.h"
+#include "internal/FlatMap.h"
 #include "internal/Variant.h"
 namespace vsjson {
 
 class Json;
 using NullImpl = detail::Null;
-using ObjectImpl = std::map<std::string, Json>;
-using ArrayImpl = std::vector<Json>;
+// define VSJSON_FLAT_OBJECT to use an insertion-ordered flat object
+// it is cheaper for small objects like RPC envelopes, see bench_vsjson.cpp
+#ifdef VSJSON_FLAT_OBJECT
+using ObjectImpl = detail::FlatMap<detail::String, Json, detail::Allocator<Json>>;
+#else
+using ObjectImpl = std::map<detail::String, Json, std::less<>,
+    detail::Allocator<std::pair<const detail::String, Json>>>;
+#endif
+using ArrayImpl = std::vector<Json, detail::Allocator<Json>>;
 using StringImpl = detail::FormatString; //std::string;
-using IntegerImpl = int;
+using StringViewImpl = detail::StringView;
+using IntegerImpl = int64_t;
+// only for integers which don't fit in IntegerImpl
+using UnsignedImpl = uint64_t;
 using DecimalImpl = double;
 using BooleanImpl = detail::Boolean;
 
@@ -19,7 +30,9 @@ detail::Variant<NullImpl,
                 ObjectImpl,
                 ArrayImpl,
                 StringImpl,
+                StringViewImpl,
                 IntegerImpl,
+                UnsignedImpl,
                 DecimalImpl,
                 BooleanImpl>;
 
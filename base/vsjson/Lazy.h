@@ -0,0 +1,241 @@
+#ifndef __JSON_LAZY_H__
+#define __JSON_LAZY_H__
+#include <bits/stdc++.h>
+#include "Json.h"
+#include "Parser.h"
+#include "JsonException.h"
+namespace vsjson {
+
+// on-demand parsing
+//
+// LazyObject / LazyArray only index the top level of a json text
+// each value is kept as RawJson (a range of the text) and parsed when required
+//
+// nothing is copied, the text must outlive all of them
+
+// unparsed json value, [begin, end) of the text
+struct RawJson {
+    const char *begin;
+    const char *end;
+
+    std::string_view text() const { return {begin, size_t(end - begin)}; }
+
+    bool isString() const { return *begin == '\"'; }
+    bool isArray() const { return *begin == '['; }
+    bool isObject() const { return *begin == '{'; }
+    bool isNumber() const { return *begin == '-' || ::isdigit(*begin); }
+
+    // see parseView()
+    Json parse(Resource *resource = nullptr) const { return parseView(begin, resource); }
+};
+
+namespace detail {
+
+// a few inline slots and then heap
+// RPC envelopes and their params rarely exceed the inline slots
+template <typename T, size_t N>
+class SmallBuffer {
+public:
+    void push_back(const T &elem) {
+        if(_size < N) _inline[_size] = elem;
+        else _overflow.push_back(elem);
+        ++_size;
+    }
+    const T& operator[](size_t index) const {
+        return index < N ? _inline[index] : _overflow[index - N];
+    }
+    size_t size() const { return _size; }
+
+private:
+    std::array<T, N> _inline {};
+    std::vector<T>   _overflow;
+    size_t           _size {};
+};
+
+} // detail
+
+class LazyObject {
+public:
+    // throws JsonException if `text` is not an object
+    explicit LazyObject(const char *text);
+
+    // nullptr if not found
+    // Note: keys are compared as they are in the text (escape sequences are not decoded)
+    const RawJson* find(std::string_view key) const;
+    bool contains(std::string_view key) const { return find(key) != nullptr; }
+    size_t size() const { return _fields.size(); }
+
+    // end of the object text
+    const char* end() const { return _end; }
+
+private:
+    using Field = std::pair<std::string_view, RawJson>;
+    detail::SmallBuffer<Field, 8> _fields;
+    const char *_end;
+};
+
+class LazyArray {
+public:
+    LazyArray(): _end(nullptr) {}
+    // throws JsonException if `text` is not an array
+    explicit LazyArray(const char *text);
+
+    const RawJson& operator[](size_t index) const { return _elements[index]; }
+    size_t size() const { return _elements.size(); }
+
+    const char* end() const { return _end; }
+
+private:
+    detail::SmallBuffer<RawJson, 8> _elements;
+    const char *_end;
+};
+
+namespace parser {
+
+// end of the literal (number, true, false, null) at `p`
+// throws JsonException if it is not well-formed, or not followed by a delimiter
+inline const char* skipLiteral(const char *p) {
+    auto isDigit = [](char ch) { return ch >= '0' && ch <= '9'; };
+    auto start = p;
+    if(!::strncmp(p, "true", 4)) p += 4;
+    else if(!::strncmp(p, "false", 5)) p += 5;
+    else if(!::strncmp(p, "null", 4)) p += 4;
+    else {
+        // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+        if(*p == '-') ++p;
+        if(*p == '0') ++p;
+        else if(isDigit(*p)) while(isDigit(*p)) ++p;
+        else p = start;
+        if(p != start && *p == '.') {
+            if(!isDigit(*++p)) p = start;
+            while(isDigit(*p)) ++p;
+        }
+        if(p != start && (*p == 'e' || *p == 'E')) {
+            if(*++p == '+' || *p == '-') ++p;
+            if(!isDigit(*p)) p = start;
+            while(isDigit(*p)) ++p;
+        }
+    }
+    if(p == start || (*p && *p != ',' && *p != '}' && *p != ']' && !isWhitespace(*p))) {
+        throw JsonException(
+            "lazy parse failure: invalid value");
+    }
+    return p;
+}
+
+// find the end of the value at `p` without building anything
+// only the structure (strings and brackets) and the top level literals are checked,
+// a value inside brackets is checked when it is parsed
+inline const char* skipValue(const char *p) {
+    p = skipWhitespace(p);
+    bool escaped;
+    switch(*p) {
+        case '\"':
+            scanString(p, escaped);
+            return p;
+        case '{':
+        case '[': {
+            size_t depth = 0;
+            do {
+                p += ::strcspn(p, "\"{}[]");
+                switch(*p) {
+                    case '\"': scanString(p, escaped); continue;
+                    case '{': case '[': ++depth; break;
+                    case '}': case ']': --depth; break;
+                    default:
+                        throw JsonException(
+                            "lazy parse failure: pair [{}] or [[]]");
+                }
+                ++p;
+            } while(depth);
+            return p;
+        }
+        default:
+            // number, true, false, null
+            return skipLiteral(p);
+    }
+}
+
+// nothing but whitespace is left at `p` (after a whole json text)
+// throws JsonException otherwise
+inline void expectEnd(const char *p) {
+    if(*skipWhitespace(p)) {
+        throw JsonException(
+            "lazy parse failure: text after value");
+    }
+}
+
+} // parser
+
+inline LazyObject::LazyObject(const char *text) {
+    const char *p = parser::skipWhitespace(text);
+    if(*p != '{') {
+        throw JsonException(
+            "lazy object failure: expect [{]");
+    }
+    p = parser::skipWhitespace(p + 1);
+    if(*p == '}') {
+        _end = p + 1;
+        return;
+    }
+    for(;;) {
+        bool escaped;
+        auto key = parser::scanString(p, escaped);
+        p = parser::skipWhitespace(p);
+        if(*p != ':') {
+            throw JsonException(
+                "lazy object failure: expect [:]");
+        }
+        auto begin = parser::skipWhitespace(p + 1);
+        p = parser::skipValue(begin);
+        _fields.push_back({key, RawJson{begin, p}});
+        p = parser::skipWhitespace(p);
+        if(*p == '}') {
+            _end = p + 1;
+            return;
+        }
+        if(*p != ',') {
+            throw JsonException(
+                "lazy object failure: unknown reason");
+        }
+        p = parser::skipWhitespace(p + 1);
+    }
+}
+
+inline const RawJson* LazyObject::find(std::string_view key) const {
+    for(size_t i = 0; i < _fields.size(); ++i) {
+        if(_fields[i].first == key) return &_fields[i].second;
+    }
+    return nullptr;
+}
+
+inline LazyArray::LazyArray(const char *text) {
+    const char *p = parser::skipWhitespace(text);
+    if(*p != '[') {
+        throw JsonException(
+            "lazy array failure: expect [[]");
+    }
+    p = parser::skipWhitespace(p + 1);
+    if(*p == ']') {
+        _end = p + 1;
+        return;
+    }
+    for(;;) {
+        auto begin = p;
+        p = parser::skipValue(begin);
+        _elements.push_back(RawJson{begin, p});
+        p = parser::skipWhitespace(p);
+        if(*p == ']') {
+            _end = p + 1;
+            return;
+        }
+        if(*p != ',') {
+            throw JsonException(
+                "lazy array failure: unknown reason");
+        }
+        p = parser::skipWhitespace(p + 1);
+    }
+}
+
+} // vsjson
+#endif
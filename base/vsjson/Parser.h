@@ -7,28 +7,45 @@ namespace vsjson {
 
 /// interface
 
-Json parse(const char *p);
-Json parse(const std::string &str);
+// containers and strings are allocated from `resource`
+// nullptr means global heap, see Arena for a cheaper one
+Json parse(const char *p, Resource *resource = nullptr);
+Json parse(const std::string &str, Resource *resource = nullptr);
+
+// the same as parse(), but strings without escape sequence
+// are views into `p` (StringViewImpl) instead of copies
+//
+// `p` must outlive the returned json (and everything moved from it)
+// copies are always safe, a copied view becomes an owned string
+Json parseView(const char *p, Resource *resource = nullptr);
 
 /// impl
 
 namespace parser {
-    Json parseImpl(const char *&p);
+    struct Context {
+        Resource *resource;
+        bool      view;
+    };
+
+    Json parseImpl(const char *&p, const Context &context);
     Json parseNumberImpl(const char *&p);
-    StringImpl parseString(const char *&p);
-    Json parseObject(const char *&p);
-    Json parseArray(const char *&p);
-    IntegerImpl parseInteger(const char *&p);
-    DecimalImpl parseDeciaml(const char *&p);
-    DecimalImpl parseExponent(const char *&p);
+    std::string_view scanString(const char *&p, bool &escaped);
+    StringImpl makeString(std::string_view raw, bool escaped, Resource *resource);
+    StringImpl parseString(const char *&p, Resource *resource);
+    Json parseObject(const char *&p, const Context &context);
+    Json parseArray(const char *&p, const Context &context);
+}
+
+inline Json parse(const char *p, Resource *resource) {
+    return parser::parseImpl(p, {resource, false});
 }
 
-inline Json parse(const char *p) {
-    return parser::parseImpl(p);
+inline Json parse(const std::string &str, Resource *resource) {
+    return parse(str.data(), resource);
 }
 
-inline Json parse(const std::string &str) {
-    return parse(str.data());
+inline Json parseView(const char *p, Resource *resource) {
+    return parser::parseImpl(p, {resource, true});
 }
 
 namespace parser {
@@ -42,18 +59,22 @@ inline const char* skipWhitespace(const char *p) {
     return p;
 }
 
-inline Json parseImpl(const char *&p) {
+inline Json parseImpl(const char *&p, const Context &context) {
     p = skipWhitespace(p);
     if(!p || !*p) return nullptr;
-    IntegerImpl buf = 0;
-    bool neg = false;
     switch (*p) {
         case '{':
-            return parseObject(p);
+            return parseObject(p, context);
         case '[':
-            return parseArray(p);
-        case '\"':
-            return parseString(p);
+            return parseArray(p, context);
+        case '\"': {
+            bool escaped;
+            auto raw = scanString(p, escaped);
+            if(context.view && !escaped) {
+                return StringViewImpl(raw);
+            }
+            return makeString(raw, escaped, context.resource);
+        }
         case 'n':
             p += 4;
             return nullptr;
@@ -83,41 +104,112 @@ inline Json parseImpl(const char *&p) {
     return nullptr;
 }
 
+// integers are exact in [INT64_MIN, UINT64_MAX]
+// and fall back to double outside that range
+// decimals are correctly rounded
+//
+// fast paths are taken in one pass for short numbers,
+// everything else goes to from_chars (see detail::readDecimal)
 inline Json parseNumberImpl(const char *&p) {
-    bool neg = false;
-    if(*p == '-') {
-        ++p;
-        neg = true;
+    // 1e0 ... 1e22 are exact in double
+    constexpr static DecimalImpl pows[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    auto isDigit = [](char ch) { return ch >= '0' && ch <= '9'; };
+
+    const char *start = p;
+    bool neg = (*p == '-');
+    if(neg) ++p;
+
+    // all the significant digits, exact if no more than 19 digits
+    uint64_t mantissa = 0;
+    const char *q = p;
+    for(; isDigit(*q); ++q) mantissa = mantissa * 10 + (*q - '0');
+    ptrdiff_t digits = q - p;
+    bool decimal = false;
+    int exponent = 0;
+    if(*q == '.') {
+        decimal = true;
+        const char *fraction = ++q;
+        for(; isDigit(*q); ++q) mantissa = mantissa * 10 + (*q - '0');
+        digits += q - fraction;
+        exponent = -(q - fraction);
     }
-    if(isdigit(*p)) {
-        IntegerImpl integer = parseInteger(p);
-        if(*p != '.') {
-            return !neg ? integer : -integer;
+    if(*q == 'e' || *q == 'E') {
+        decimal = true;
+        ++q;
+        bool expNeg = (*q == '-');
+        if(*q == '+' || *q == '-') ++q;
+        int e = 0;
+        for(; isDigit(*q); ++q) {
+            if(e < 100000) e = e * 10 + (*q - '0');
         }
-        // *p == '.'
-        DecimalImpl decimal = parseDeciaml(p);
-        decimal += integer;
-        if(*p != 'e' && *p != 'E') {
-            return !neg ? decimal : -decimal;
+        exponent += expNeg ? -e : e;
+    }
+    const char *end = q;
+
+    // at most 18 digits never overflow
+    if(!decimal && digits > 0 && digits <= 18) {
+        p = end;
+        IntegerImpl integer = mantissa;
+        return !neg ? integer : -integer;
+    }
+
+    // Clinger's fast path: both mantissa and 10^|exponent| are exact
+    // so a single multiplication / division is correctly rounded
+    if(decimal && digits > 0 && digits <= 15 && exponent >= -22 && exponent <= 22) {
+        p = end;
+        DecimalImpl d = mantissa;
+        d = exponent < 0 ? d / pows[-exponent] : d * pows[exponent];
+        return !neg ? d : -d;
+    }
+
+    if(!decimal) {
+        IntegerImpl integer;
+        auto result = std::from_chars(start, end, integer);
+        if(result.ec == std::errc{} && result.ptr == end) {
+            p = end;
+            return integer;
+        }
+        UnsignedImpl uinteger;
+        result = std::from_chars(start, end, uinteger);
+        if(result.ec == std::errc{} && result.ptr == end) {
+            p = end;
+            return uinteger;
         }
-        // *p == 'e' || *p == 'E'
-        DecimalImpl e = parseExponent(p);
-        return !neg ? e*decimal : -e*decimal;
     }
-    return nullptr;
+    DecimalImpl d;
+    auto [last, err] = detail::readDecimal(start, end, d);
+    if(err == std::errc::invalid_argument || last != end) {
+        throw JsonException(
+            "number parse failure: invalid format");
+    }
+    if(err == std::errc::result_out_of_range) {
+        // rare case, from_chars leaves `d` unmodified
+        // strtod gives +-HUGE_VAL or 0
+        d = std::strtod(start, nullptr);
+    }
+    p = end;
+    return d;
 }
 
-inline Json parseObject(const char *&p) {
+inline Json parseObject(const char *&p, const Context &context) {
     ++p; // {
     p = skipWhitespace(p);
-    Json object(ObjectImpl{});
+    Json object = ObjectImpl(ObjectImpl::allocator_type(context.resource));
+    auto &map = object.as<ObjectImpl>();
     if(*p == '}') {
         ++p;
         return object;
     }
     for(;;) {
         p = skipWhitespace(p);
-        StringImpl key = parseString(p);
+        bool escaped;
+        auto raw = scanString(p, escaped);
+        // keys are always owned
+        // protocol keys are short enough to avoid heap allocation (SSO)
+        StringImpl key = makeString(raw, escaped, context.resource);
         p = skipWhitespace(p);
         if(*p != ':') {
             throw JsonException(
@@ -125,7 +217,7 @@ inline Json parseObject(const char *&p) {
         }
         ++p; // :
         p = skipWhitespace(p);
-        object[key] = parseImpl(p);
+        map.insert_or_assign(std::move(key), parseImpl(p, context));
         p = skipWhitespace(p);
         if(*p == '}') {
             ++p;
@@ -140,18 +232,17 @@ inline Json parseObject(const char *&p) {
     return object;
 }
 
-inline Json parseArray(const char *&p) {
+inline Json parseArray(const char *&p, const Context &context) {
     ++p;
     p = skipWhitespace(p);
-    Json array = Json::array();
+    Json array = ArrayImpl(ArrayImpl::allocator_type(context.resource));
     if(*p == ']') {
         ++p;
         return array;
     }
     for(;;) {
         p = skipWhitespace(p);
-        auto r = parseImpl(p);
-        array.append(r);
+        array.append(parseImpl(p, context));
         p = skipWhitespace(p);
         if(*p == ']') {
             ++p;
@@ -166,7 +257,9 @@ inline Json parseArray(const char *&p) {
     return array;
 }
 
-inline StringImpl parseString(const char *&p) {
+// return raw content between quotes, p is moved after the closing quote
+// `escaped` is set if there is any escape sequence in it
+inline std::string_view scanString(const char *&p, bool &escaped) {
     p = skipWhitespace(p);
     if(*p != '\"') {
         throw JsonException(
@@ -174,78 +267,103 @@ inline StringImpl parseString(const char *&p) {
     }
     ++p; // "
     auto start = p;
-    while(p && *p != '\"') {
-        if(*p == '\\') ++p; // switch-case *p: quote / solidus / backspace...
+    escaped = false;
+    for(;;) {
+        p += ::strcspn(p, "\"\\");
+        if(*p != '\\') break;
+        escaped = true;
+        // skip the escaped character, maybe a quote
+        if(!*++p) break;
         ++p;
     }
-    if(!p) {
+    if(!*p) {
         throw JsonException(
             "string parse failure: pair [\"]");
     }
     auto end = p; //[start, end)
     ++p; // "
-    return StringImpl(start, end - start);
+    return {start, size_t(end - start)};
 }
 
-inline IntegerImpl parseInteger(const char *&p) {
-    IntegerImpl i = 0;
-    p = skipWhitespace(p);
-    while(p && isdigit(*p)) { // -
-        i = i*10 + (*p - '0');
-        ++p;
-    }
-    p = skipWhitespace(p);
-    if(!p || !*p) {
+inline uint32_t parseHex4(const char *p, const char *end) {
+    if(end - p < 4) {
         throw JsonException(
-            "integer parse failure: assert non-\\n");
+            "string parse failure: bad \\u escape");
     }
-    return i;
+    uint32_t code = 0;
+    for(const char *q = p; q != p + 4; ++q) {
+        code <<= 4;
+        if(*q >= '0' && *q <= '9') code |= *q - '0';
+        else if(*q >= 'a' && *q <= 'f') code |= *q - 'a' + 10;
+        else if(*q >= 'A' && *q <= 'F') code |= *q - 'A' + 10;
+        else throw JsonException(
+            "string parse failure: bad \\u escape");
+    }
+    return code;
 }
 
-inline DecimalImpl parseDeciaml(const char *&p) {
-    ++p; // '.'
-    p = skipWhitespace(p);
-    DecimalImpl d = 0, idx = 0.1;
-    while(p && isdigit(*p)) {
-        d += idx * ((*p) - '0');
-        idx *= 0.1;
-        ++p;
+inline void appendUtf8(StringImpl &str, uint32_t code) {
+    if(code < 0x80) {
+        str += char(code);
+    } else if(code < 0x800) {
+        str += char(0xc0 | (code >> 6));
+        str += char(0x80 | (code & 0x3f));
+    } else if(code < 0x10000) {
+        str += char(0xe0 | (code >> 12));
+        str += char(0x80 | ((code >> 6) & 0x3f));
+        str += char(0x80 | (code & 0x3f));
+    } else {
+        str += char(0xf0 | (code >> 18));
+        str += char(0x80 | ((code >> 12) & 0x3f));
+        str += char(0x80 | ((code >> 6) & 0x3f));
+        str += char(0x80 | (code & 0x3f));
     }
-    p = skipWhitespace(p);
-    if(!p || !*p) {
-        throw JsonException(
-            "decimal parse failure: assert non-\\n");
-    }
-    return d;
 }
 
-template <typename>
-struct ExponentCache;
-
-// generate 1.0, 10.0, 100.0... at compile time
-template <size_t ...Is>
-struct ExponentCache<std::index_sequence<Is...>> {
-    constexpr static DecimalImpl pows[] = {std::pow(10, Is)...};
-};
-
-template <size_t ...Is>
-constexpr DecimalImpl ExponentCache<std::index_sequence<Is...>>::pows[];
-
-inline DecimalImpl parseExponent(const char *&p) {
-    static constexpr size_t exponentLimit = 309;
-    using Generator = std::make_index_sequence<exponentLimit>;
-    ++p; // e E
-    p = skipWhitespace(p);
-    bool neg = (*p == '-');
-    if(*p == '+' || *p == '-') ++p;
-    IntegerImpl i = parseInteger(p);
-    p = skipWhitespace(p);
-    if(!p || !*p) {
-        throw JsonException(
-            "exponent parse failure: assert non-\\n");
+inline StringImpl makeString(std::string_view raw, bool escaped, Resource *resource) {
+    if(!escaped) {
+        return StringImpl(raw.data(), raw.size(), resource);
     }
-    DecimalImpl e = ExponentCache<Generator>::pows[i];
-    return !neg ? e : 1.0/e;
+    StringImpl str(resource);
+    str.reserve(raw.size());
+    const char *end = raw.data() + raw.size();
+    for(const char *p = raw.data(); p != end; ++p) {
+        if(*p != '\\') {
+            str += *p;
+            continue;
+        }
+        switch(*++p) {
+            case 'b': str += '\b'; break;
+            case 'f': str += '\f'; break;
+            case 'n': str += '\n'; break;
+            case 'r': str += '\r'; break;
+            case 't': str += '\t'; break;
+            case 'u': {
+                uint32_t code = parseHex4(p + 1, end);
+                p += 4;
+                // surrogate pair
+                if(code >= 0xd800 && code < 0xdc00
+                        && end - p > 6 && p[1] == '\\' && p[2] == 'u') {
+                    uint32_t low = parseHex4(p + 3, end);
+                    if(low >= 0xdc00 && low < 0xe000) {
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                        p += 6;
+                    }
+                }
+                appendUtf8(str, code);
+                break;
+            }
+            // quote / reverse solidus / solidus
+            default: str += *p; break;
+        }
+    }
+    return str;
+}
+
+inline StringImpl parseString(const char *&p, Resource *resource) {
+    bool escaped;
+    auto raw = scanString(p, escaped);
+    return makeString(raw, escaped, resource);
 }
 
 } // parser
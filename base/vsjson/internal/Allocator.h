@@ -0,0 +1,73 @@
+#ifndef __JSON_UTILS_ALLOCATOR_H__
+#define __JSON_UTILS_ALLOCATOR_H__
+#include <bits/stdc++.h>
+namespace vsjson {
+
+using Resource = std::pmr::memory_resource;
+
+namespace detail {
+
+// stateful allocator used by every json container
+//
+// nullptr resource means global operator new / delete
+// and it is the default one, so a plain json never pays for virtual call
+//
+// copies never inherit the resource (see select_on_container_copy_construction)
+// only moves do, so an arena-allocated tree cannot escape by copy
+template <typename T>
+class Allocator {
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+public:
+    Allocator() noexcept: _resource(nullptr) {}
+    Allocator(Resource *resource) noexcept: _resource(resource) {}
+    template <typename U>
+    Allocator(const Allocator<U> &rhs) noexcept: _resource(rhs.resource()) {}
+
+    T* allocate(size_t n);
+    void deallocate(T *p, size_t n);
+
+    Allocator select_on_container_copy_construction() const { return {}; }
+
+    Resource* resource() const { return _resource; }
+
+private:
+    Resource *_resource;
+};
+
+template <typename T>
+inline T* Allocator<T>::allocate(size_t n) {
+    if(!_resource) {
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(_resource->allocate(n * sizeof(T), alignof(T)));
+}
+
+template <typename T>
+inline void Allocator<T>::deallocate(T *p, size_t n) {
+    if(!_resource) {
+        ::operator delete(p);
+        return;
+    }
+    _resource->deallocate(p, n * sizeof(T), alignof(T));
+}
+
+template <typename T, typename U>
+inline bool operator==(const Allocator<T> &lhs, const Allocator<U> &rhs) {
+    return lhs.resource() == rhs.resource();
+}
+
+template <typename T, typename U>
+inline bool operator!=(const Allocator<T> &lhs, const Allocator<U> &rhs) {
+    return !(lhs == rhs);
+}
+
+using String = std::basic_string<char, std::char_traits<char>, Allocator<char>>;
+
+} // detail
+} // vsjson
+#endif
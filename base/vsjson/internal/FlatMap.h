@@ -0,0 +1,232 @@
+#ifndef __JSON_UTILS_FLAT_MAP_H__
+#define __JSON_UTILS_FLAT_MAP_H__
+#include <bits/stdc++.h>
+namespace vsjson {
+namespace detail {
+
+// insertion-ordered object storage: a flat vector of key/value pairs
+//
+// lookup is a linear scan for small objects (the common case of RPC envelopes)
+// and switches to an open addressing index of positions after HASH_THRESHOLD keys
+//
+// Key must be convertible to std::string_view
+//
+// T is still incomplete here (Json contains ObjectImpl),
+// so an inline buffer is impossible, the first insertion reserves
+// INITIAL_CAPACITY slots instead (a single allocation, or a bump in arena)
+template <typename Key, typename T, typename Alloc>
+class FlatMap {
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using value_type = std::pair<Key, T>;
+    using allocator_type = typename std::allocator_traits<Alloc>::template rebind_alloc<value_type>;
+    using size_type = size_t;
+
+private:
+    using Container = std::vector<value_type, allocator_type>;
+    using Position = uint32_t;
+    using IndexAllocator = typename std::allocator_traits<Alloc>::template rebind_alloc<Position>;
+    using Index = std::vector<Position, IndexAllocator>;
+
+public:
+    using iterator = typename Container::iterator;
+    using const_iterator = typename Container::const_iterator;
+
+    constexpr static size_t INITIAL_CAPACITY = 8;
+    constexpr static size_t HASH_THRESHOLD = 16;
+
+public:
+    FlatMap() = default;
+    explicit FlatMap(const allocator_type &alloc): _elements(alloc), _index(alloc) {}
+    FlatMap(std::initializer_list<value_type> list, const allocator_type &alloc = allocator_type());
+
+    FlatMap(const FlatMap&) = default;
+    FlatMap(FlatMap&&) = default;
+    FlatMap& operator=(const FlatMap&) = default;
+    FlatMap& operator=(FlatMap&&) = default;
+
+    iterator begin() { return _elements.begin(); }
+    iterator end() { return _elements.end(); }
+    const_iterator begin() const { return _elements.begin(); }
+    const_iterator end() const { return _elements.end(); }
+
+    size_t size() const { return _elements.size(); }
+    bool empty() const { return _elements.empty(); }
+
+    template <typename K> iterator find(const K &key);
+    template <typename K> const_iterator find(const K &key) const;
+    template <typename K> size_t count(const K &key) const;
+
+    T& operator[](const Key &key);
+    T& operator[](Key &&key);
+
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(Key &&key, M &&obj);
+
+    // the same as std::map, keep the first one if key exists
+    template <typename K, typename ...Args>
+    std::pair<iterator, bool> try_emplace(K &&key, Args &&...args);
+
+    size_t erase(const Key &key);
+
+    void clear() { _elements.clear(); _index.clear(); }
+
+    allocator_type get_allocator() const { return _elements.get_allocator(); }
+
+private:
+    constexpr static Position NOT_FOUND = std::numeric_limits<Position>::max();
+
+    Position lookup(std::string_view key) const;
+
+    template <typename K, typename ...Args>
+    iterator append(K &&key, Args &&...args);
+
+    void indexInsert(Position pos);
+    void rehash();
+
+    static size_t hash(std::string_view key) { return std::hash<std::string_view>{}(key); }
+
+private:
+    Container _elements;
+    // empty until size() > HASH_THRESHOLD
+    // slot value is position + 1, 0 means empty slot
+    Index     _index;
+};
+
+template <typename Key, typename T, typename Alloc>
+inline FlatMap<Key, T, Alloc>::FlatMap(std::initializer_list<value_type> list, const allocator_type &alloc)
+    : _elements(alloc),
+      _index(alloc)
+{
+    _elements.reserve(list.size());
+    for(auto &elem : list) {
+        try_emplace(elem.first, elem.second);
+    }
+}
+
+template <typename Key, typename T, typename Alloc>
+template <typename K>
+inline auto FlatMap<Key, T, Alloc>::find(const K &key) -> iterator {
+    Position pos = lookup(key);
+    return pos == NOT_FOUND ? end() : begin() + pos;
+}
+
+template <typename Key, typename T, typename Alloc>
+template <typename K>
+inline auto FlatMap<Key, T, Alloc>::find(const K &key) const -> const_iterator {
+    Position pos = lookup(key);
+    return pos == NOT_FOUND ? end() : begin() + pos;
+}
+
+template <typename Key, typename T, typename Alloc>
+template <typename K>
+inline size_t FlatMap<Key, T, Alloc>::count(const K &key) const {
+    return lookup(key) != NOT_FOUND;
+}
+
+template <typename Key, typename T, typename Alloc>
+inline T& FlatMap<Key, T, Alloc>::operator[](const Key &key) {
+    return try_emplace(key).first->second;
+}
+
+template <typename Key, typename T, typename Alloc>
+inline T& FlatMap<Key, T, Alloc>::operator[](Key &&key) {
+    return try_emplace(std::move(key)).first->second;
+}
+
+template <typename Key, typename T, typename Alloc>
+template <typename M>
+inline auto FlatMap<Key, T, Alloc>::insert_or_assign(Key &&key, M &&obj) -> std::pair<iterator, bool> {
+    Position pos = lookup(key);
+    if(pos != NOT_FOUND) {
+        auto iter = begin() + pos;
+        iter->second = std::forward<M>(obj);
+        return {iter, false};
+    }
+    return {append(std::move(key), std::forward<M>(obj)), true};
+}
+
+template <typename Key, typename T, typename Alloc>
+template <typename K, typename ...Args>
+inline auto FlatMap<Key, T, Alloc>::try_emplace(K &&key, Args &&...args) -> std::pair<iterator, bool> {
+    Position pos = lookup(key);
+    if(pos != NOT_FOUND) {
+        return {begin() + pos, false};
+    }
+    return {append(std::forward<K>(key), std::forward<Args>(args)...), true};
+}
+
+template <typename Key, typename T, typename Alloc>
+inline size_t FlatMap<Key, T, Alloc>::erase(const Key &key) {
+    Position pos = lookup(key);
+    if(pos == NOT_FOUND) return 0;
+    _elements.erase(begin() + pos);
+    // positions after `pos` are shifted
+    if(!_index.empty()) rehash();
+    return 1;
+}
+
+template <typename Key, typename T, typename Alloc>
+inline auto FlatMap<Key, T, Alloc>::lookup(std::string_view key) const -> Position {
+    if(_index.empty()) {
+        for(Position pos = 0; pos < _elements.size(); ++pos) {
+            if(std::string_view(_elements[pos].first) == key) return pos;
+        }
+        return NOT_FOUND;
+    }
+    size_t mask = _index.size() - 1;
+    for(size_t slot = hash(key) & mask; _index[slot]; slot = (slot + 1) & mask) {
+        Position pos = _index[slot] - 1;
+        if(std::string_view(_elements[pos].first) == key) return pos;
+    }
+    return NOT_FOUND;
+}
+
+template <typename Key, typename T, typename Alloc>
+template <typename K, typename ...Args>
+inline auto FlatMap<Key, T, Alloc>::append(K &&key, Args &&...args) -> iterator {
+    if(_elements.capacity() == 0) {
+        _elements.reserve(INITIAL_CAPACITY);
+    }
+    _elements.emplace_back(std::piecewise_construct,
+        std::forward_as_tuple(std::forward<K>(key)),
+        std::forward_as_tuple(std::forward<Args>(args)...));
+    Position pos = _elements.size() - 1;
+    if(_elements.size() > HASH_THRESHOLD) {
+        // keep load factor <= 0.5
+        if(_index.size() < 2 * _elements.size()) {
+            rehash();
+        } else {
+            indexInsert(pos);
+        }
+    }
+    return begin() + pos;
+}
+
+template <typename Key, typename T, typename Alloc>
+inline void FlatMap<Key, T, Alloc>::indexInsert(Position pos) {
+    size_t mask = _index.size() - 1;
+    size_t slot = hash(_elements[pos].first) & mask;
+    while(_index[slot]) slot = (slot + 1) & mask;
+    _index[slot] = pos + 1;
+}
+
+template <typename Key, typename T, typename Alloc>
+inline void FlatMap<Key, T, Alloc>::rehash() {
+    _index.clear();
+    if(_elements.size() <= HASH_THRESHOLD) {
+        _index.shrink_to_fit();
+        return;
+    }
+    size_t capacity = HASH_THRESHOLD * 2;
+    while(capacity < 4 * _elements.size()) capacity <<= 1;
+    _index.resize(capacity);
+    for(Position pos = 0; pos < _elements.size(); ++pos) {
+        indexInsert(pos);
+    }
+}
+
+} // detail
+} // vsjson
+#endif
@@ -1,6 +1,8 @@
 #ifndef __JSON_UTILS_TYPE_COMPAT_H__
 #define __JSON_UTILS_TYPE_COMPAT_H__
 #include <bits/stdc++.h>
+#include "Allocator.h"
+#include "TypeTraits.h"
 namespace vsjson {
 namespace detail {
 
@@ -28,23 +30,192 @@ struct Null {
     }
 };
 
-struct FormatString: public std::string {
-    using Base = std::string;
+// numbers
+
+template <typename T>
+using RequireNumber = std::enable_if_t<std::is_arithmetic<T>::value
+    && !std::is_same<T, bool>::value>;
+
+template <typename T>
+using NumberStorage = std::conditional_t<std::is_floating_point<T>::value, double,
+    std::conditional_t<std::is_signed<T>::value, int64_t, uint64_t>>;
+
+// `number` fits in the integer type U (a decimal is truncated first),
+// instead of wrapping silently
+template <typename U, typename T>
+inline bool inRange(T number) {
+    using Limits = std::numeric_limits<U>;
+    if constexpr (std::is_floating_point<T>::value) {
+        // also false for nan
+        auto truncated = std::trunc(number);
+        return truncated >= static_cast<T>(Limits::min())
+            && truncated < std::ldexp(T(1), Limits::digits);
+    } else if constexpr (std::is_signed<T>::value == std::is_signed<U>::value) {
+        return number >= Limits::min() && number <= Limits::max();
+    } else if constexpr (std::is_signed<T>::value) {
+        return number >= 0 && static_cast<std::make_unsigned_t<T>>(number) <= Limits::max();
+    } else {
+        return number <= static_cast<std::make_unsigned_t<U>>(Limits::max());
+    }
+}
+
+// throws std::out_of_range if a number converted to an integer type does not fit in it
+template <typename U, typename T>
+inline void checkRange(const T &value) {
+    if constexpr (std::is_arithmetic<T>::value && std::is_integral<U>::value
+            && !std::is_same<U, bool>::value) {
+        if(!inRange<U>(value)) {
+            throw std::out_of_range("[number] out of range of [type]" + std::string(typeid(U).name()));
+        }
+    }
+}
+
+// floating point std::to_chars / std::from_chars come with GCC 11 (and a late libc++),
+// older ones (g++8, see README) fall back to snprintf / strtod,
+// which give the same numbers (in the "C" locale), only slower
+// VSJSON_NO_FLOAT_CHARCONV forces the fallback
+#if defined(__cpp_lib_to_chars) && !defined(VSJSON_NO_FLOAT_CHARCONV)
+#define VSJSON_FLOAT_CHARCONV
+#endif
+
+// the shortest digits of a finite `number` which are parsed back exactly
+// `buf` has 32 chars at least, return the end
+inline char* writeDecimal(char *buf, double number) {
+#ifdef VSJSON_FLOAT_CHARCONV
+    return std::to_chars(buf, buf + 32, number).ptr;
+#else
+    // 17 significant digits always round-trip
+    int length = 0;
+    for(int precision = 15; precision <= 17; ++precision) {
+        length = std::snprintf(buf, 32, "%.*g", precision, number);
+        if(std::strtod(buf, nullptr) == number) break;
+    }
+    return buf + length;
+#endif
+}
+
+// the same as std::from_chars() for a decimal
+// `first` is a number already delimited by the parser (it stops at `last` or before)
+inline std::from_chars_result readDecimal(const char *first, const char *last, double &number) {
+#ifdef VSJSON_FLOAT_CHARCONV
+    return std::from_chars(first, last, number);
+#else
+    char *stop;
+    errno = 0;
+    double value = std::strtod(first, &stop);
+    if(stop == first || stop > last) return {first, std::errc::invalid_argument};
+    if(errno == ERANGE) return {stop, std::errc::result_out_of_range};
+    number = value;
+    return {stop, std::errc{}};
+#endif
+}
+
+// shortest representation which round-trips exactly (to_chars)
+// a decimal always keeps its '.' or exponent, so it is parsed back as a decimal
+template <typename T>
+inline void writeNumber(std::ostream &os, T number) {
+    char buf[32];
+    char *end;
+    if constexpr (std::is_floating_point<T>::value) {
+        // no inf or nan in json
+        if(!std::isfinite(number)) {
+            os << "null";
+            return;
+        }
+        end = writeDecimal(buf, number);
+        if(std::none_of(buf, end, [](char c) { return c == '.' || c == 'e'; })) {
+            *end++ = '.';
+            *end++ = '0';
+        }
+    } else {
+        end = std::to_chars(buf, buf + sizeof buf, number).ptr;
+    }
+    os.write(buf, end - buf);
+}
+
+// write `str` as the content of a json string
+// fast path: nothing to escape, write it at once
+inline void writeEscaped(std::ostream &os, std::string_view str) {
+    auto special = [](unsigned char ch) { return ch == '\"' || ch == '\\' || ch < 0x20; };
+    if(std::none_of(str.begin(), str.end(), special)) {
+        os.write(str.data(), str.size());
+        return;
+    }
+    for(unsigned char ch : str) {
+        if(!special(ch)) {
+            os.put(ch);
+            continue;
+        }
+        switch(ch) {
+            case '\"':  os << "\\\""; break;
+            case '\\': os << "\\\\"; break;
+            case '\b': os << "\\b"; break;
+            case '\f': os << "\\f"; break;
+            case '\n': os << "\\n"; break;
+            case '\r': os << "\\r"; break;
+            case '\t': os << "\\t"; break;
+            default: {
+                constexpr static char hex[] = "0123456789abcdef";
+                char u[] = {'\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 0xf]};
+                os.write(u, sizeof u);
+            }
+        }
+    }
+}
+
+struct FormatString: public String {
+    using Base = String;
     using Base::Base;
     FormatString(const Base &base): Base(base) {}
     FormatString(Base &&base): Base(static_cast<Base&&>(base)) {}
+    FormatString(const std::string &str): Base(str.data(), str.size()) {}
+    FormatString(std::string_view str): Base(str.data(), str.size()) {}
     FormatString(const FormatString &) = default;
     FormatString(FormatString &&) = default;
     FormatString& operator=(FormatString rhs) {
         rhs.swap(*this);
         return *this;
     }
+    // always a heap copy, safe to outlive the arena
+    operator std::string() const { return std::string(data(), size()); }
     friend std::ostream& operator<<(std::ostream &os, FormatString &fs) {
-        os << '\"' << static_cast<Base&>(fs) << '\"';
+        os << '\"';
+        writeEscaped(os, fs);
+        os << '\"';
+        return os;
+    }
+};
+
+// zero-copy string, points to the parsed text directly
+// only made by parser for strings without any escape sequence
+//
+// a view is materialized into FormatString once it is copied
+// (see Materialize), so only moves keep pointing to the text
+struct StringView: public std::string_view {
+    using Base = std::string_view;
+    using Base::Base;
+    StringView(Base base): Base(base) {}
+    operator std::string() const { return std::string(data(), size()); }
+    friend std::ostream& operator<<(std::ostream &os, StringView &sv) {
+        os << '\"';
+        writeEscaped(os, sv);
+        os << '\"';
         return os;
     }
 };
 
+template <>
+struct Materialize<StringView> {
+    using Type = FormatString;
+};
+
+// a json holds no std::string (but FormatString, or a view),
+// so as<std::string>() is a copy
+template <>
+struct As<std::string> {
+    using Type = std::string;
+};
+
 } // detail
 } // vsjson
 #endif
\ No newline at end of file
@@ -82,6 +82,22 @@ using Require = RequireBool<Conds::value...>;
 template <typename ...Conds>
 using RequireNot = RequireBool<(!Conds::value)...>;
 
+// materialize
+// the type a copy of T is stored as, see StringView
+
+template <typename T>
+struct Materialize {
+    using Type = T;
+};
+
+// as
+// the result of Json::as<T>(), a reference into the json by default
+
+template <typename T>
+struct As {
+    using Type = T&;
+};
+
 } // detail
 } // vsjson
 #endif
\ No newline at end of file
@@ -188,12 +188,16 @@ void Variant<Ts...>::swap(Variant &rhs) {
     std::swap(*this, rhs);
 }
 
+// a copy may be stored as another type (e.g. a string view becomes an owned string)
+// a move never changes the type
 template <typename ...Ts>
 template<typename T>
 inline void Variant<Ts...>::init(T &&obj) {
     using DecayT = std::decay_t<T>;
-    _what = Position<DecayT, Ts...>::pos;
-    new(_handle) DecayT(std::forward<T>(obj));
+    using StoreT = std::conditional_t<std::is_rvalue_reference<T&&>::value,
+        DecayT, typename Materialize<DecayT>::Type>;
+    _what = Position<StoreT, Ts...>::pos;
+    new(_handle) StoreT(std::forward<T>(obj));
 }
 
 template <typename ...Ts>
@@ -3,6 +3,7 @@
 #include <bits/stdc++.h>
 #include "TypeTraits.h"
 #include "VisitorHelper.h"
+#include "TypeCompat.h"
 namespace vsjson {
 namespace detail {
 
@@ -53,6 +54,10 @@ struct OsVisitor: public Return<std::ostream&> {
         return _os;
     }
 
+    std::ostream& operator()(int64_t &obj) { writeNumber(_os, obj); return _os; }
+    std::ostream& operator()(uint64_t &obj) { writeNumber(_os, obj); return _os; }
+    std::ostream& operator()(double &obj) { writeNumber(_os, obj); return _os; }
+
     template <typename T, typename = RequireNot<StreamSupport<T>>>
     std::ostream& operator()(T &obj, ...) {
         throw std::runtime_error("[type]" + std::string(typeid(obj).name())
@@ -64,7 +69,7 @@ struct OsVisitor: public Return<std::ostream&> {
 template <typename U>
 struct ConvertVisitor: public Return<U> {
     template <typename T, typename = Require<std::is_convertible<T, U>>>
-    U operator()(T &obj) { return obj; }
+    U operator()(T &obj) { checkRange<U>(obj); return obj; }
     template <typename T, typename = RequireNot<std::is_convertible<T, U>>>
     U operator()(T &obj, ...) {
         throw std::runtime_error("[type]" + std::string(typeid(obj).name())
@@ -76,7 +81,7 @@ struct ConvertVisitor: public Return<U> {
 template <typename U>
 struct MovedConvertVisitor: public Return<U> {
     template <typename T, typename = Require<std::is_convertible<T, U>>>
-    U operator()(T &obj) { return std::move(obj); }
+    U operator()(T &obj) { checkRange<U>(obj); return std::move(obj); }
     template <typename T, typename = RequireNot<std::is_convertible<T, U>>>
     U operator()(T &obj, ...) {
         throw std::runtime_error("[type]" + std::string(typeid(obj).name())
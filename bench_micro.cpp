@@ -0,0 +1,220 @@
+#include <bits/stdc++.h>
+#include <sys/eventfd.h>
+#include "co.hpp"
+#include "vsjson.hpp"
+#include "trpc/detail/Codec.h"
+#include "trpc/detail/MethodTable.h"
+#include "trpc/detail/resolve.h"
+// heap allocations of this process (all the forms of operator new are counted)
+#define TRPC_COUNT_ALLOCATIONS
+#include "trpc/detail/Allocations.h"
+
+// micro-benchmarks of the hot paths: co, vsjson and codec
+//
+// g++ -std=c++17 -O2 -I base -I . bench_micro.cpp -o bench_micro
+// g++ -std=c++17 -O2 -I base -I . -DVSJSON_FLAT_OBJECT bench_micro.cpp -o bench_micro_flat
+
+using namespace std::chrono;
+
+// keep results alive
+volatile size_t gSink;
+
+// single thread, see trpc::detail::Allocations
+size_t allocated() { return trpc::detail::Allocations::local().count; }
+
+void report(const char *name, double ns, double allocations) {
+    std::cout << std::left << std::setw(44) << name
+              << std::setw(12) << ns << " ns/op  "
+              << allocations << " allocs/op" << std::endl;
+}
+
+template <typename Func>
+void bench(const char *name, size_t iterations, Func &&func) {
+    // warmup
+    for(size_t i = 0; i < iterations / 10; ++i) func();
+    auto allocations = allocated();
+    auto start = steady_clock::now();
+    for(size_t i = 0; i < iterations; ++i) func();
+    auto end = steady_clock::now();
+    allocations = allocated() - allocations;
+    report(name, duration<double, std::nano>{end - start}.count() / iterations,
+           double(allocations) / iterations);
+}
+
+const std::string requestText =
+    R"({"jsonrpc":"2.0","id":19260817,"method":"append","params":["jojo","dio"],"timeout":500})";
+
+const std::string responseText =
+    R"({"jsonrpc":"2.0","id":19260817,"result":"jojodio"})";
+
+void benchCoroutine() {
+    auto &env = co::open();
+    constexpr size_t N = 1 << 20;
+
+    auto pingpong = env.createCoroutine([] {
+        while(1) co::this_coroutine::yield();
+    });
+    bench("co: resume + yield", N, [&] {
+        pingpong->resume();
+    });
+
+    // the context of an exited coroutine is recycled by the next one
+    bench("co: createCoroutine + resume (recycled)", N / 4, [&] {
+        auto coroutine = env.createCoroutine([] {});
+        coroutine->resume();
+    });
+
+    // contexts are held by unfinished coroutines, so every one is allocated
+    // (the recycle stack is kept empty, it has room for 255 contexts)
+    {
+        constexpr size_t BATCH = 256, ROUNDS = 16;
+        std::vector<std::shared_ptr<co::Coroutine>> held, drain;
+        auto park = [] { co::this_coroutine::yield(); };
+        double ns = 0;
+        size_t allocations = 0;
+        for(size_t round = 0; round < ROUNDS; ++round) {
+            // take all the recycled contexts
+            for(size_t i = 0; i < 255; ++i) {
+                drain.emplace_back(env.createCoroutine(park));
+                drain.back()->resume();
+            }
+            auto before = allocated();
+            auto start = steady_clock::now();
+            for(size_t i = 0; i < BATCH; ++i) {
+                held.emplace_back(env.createCoroutine(park));
+                held.back()->resume();
+            }
+            ns += duration<double, std::nano>{steady_clock::now() - start}.count();
+            allocations += allocated() - before;
+            // finish them, contexts are recycled or freed
+            for(auto &c : held) c->resume();
+            for(auto &c : drain) c->resume();
+            held.clear();
+            drain.clear();
+        }
+        report("co: createCoroutine + resume (fresh)", ns / (BATCH * ROUNDS),
+               double(allocations) / (BATCH * ROUNDS));
+    }
+
+    int fd = ::eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+    env.createCoroutine([&] {
+        pollfd pfd {fd, POLLIN, 0};
+        bench("co: poll (1 ready fd)", N, [&] {
+            gSink = co::poll(&pfd, 1, 1000);
+        });
+    })->resume();
+    ::close(fd);
+}
+
+void benchJson() {
+    constexpr size_t N = 1 << 20;
+    vsjson::Arena arena;
+
+    bench("vsjson: parse request", N, [] {
+        auto json = vsjson::parse(requestText);
+        gSink = json.size();
+    });
+
+    bench("vsjson: parseView request (arena)", N, [&] {
+        {
+            auto json = vsjson::parseView(requestText.c_str(), arena.resource());
+            gSink = json.size();
+        }
+        arena.reset();
+    });
+
+    bench("vsjson: LazyObject request", N, [] {
+        vsjson::LazyObject lazy(requestText.c_str());
+        gSink = lazy.size();
+    });
+
+    auto request = vsjson::parse(requestText);
+    bench("vsjson: dump request", N / 4, [&] {
+        gSink = request.dump().size();
+    });
+
+    auto response = vsjson::parse(responseText);
+    bench("vsjson: dump response", N / 4, [&] {
+        gSink = response.dump().size();
+    });
+}
+
+void benchCodec() {
+    constexpr size_t N = 1 << 20;
+    vsjson::Arena arena;
+
+    trpc::detail::MethodTable table;
+    table.bind("add", trpc::detail::Method::make([](int a, int b) { return a + b; }));
+    table.bind("append", trpc::detail::Method::make([](std::string_view a, std::string_view b) {
+        return std::string(a) + std::string(b);
+    }));
+    table.freeze();
+
+    const std::string addParams = "[1,2]";
+    const std::string appendParams = R"(["jojo","dio"])";
+
+    bench("CallProxy: add(int, int) (lazy)", N, [&] {
+        {
+            vsjson::LazyArray lazy(addParams.c_str());
+            trpc::detail::Params params {lazy, arena.resource()};
+            gSink = (*table.find(0))(params).to<int>();
+        }
+        arena.reset();
+    });
+
+    bench("CallProxy: append(view, view) (lazy)", N, [&] {
+        {
+            vsjson::LazyArray lazy(appendParams.c_str());
+            trpc::detail::Params params {lazy, arena.resource()};
+            gSink = (*table.find(1))(params).is<std::string>();
+        }
+        arena.reset();
+    });
+
+    bench("CallProxy: add(int, int) (eager)", N, [&] {
+        vsjson::Json args = vsjson::Json::array(1, 2);
+        trpc::detail::Params params {args};
+        gSink = (*table.find(0))(params).to<int>();
+    });
+
+    bench("MethodTable: find by name", N, [&] {
+        gSink = table.id("append");
+    });
+
+    trpc::detail::Codec codec;
+    auto response = vsjson::parse(responseText);
+    bench("Codec: dump response", N / 4, [&] {
+        auto [dump, length, beLength] = codec.dump(response);
+        gSink = dump.size() + length + beLength;
+    });
+
+    std::string buffer;
+    bench("Codec: dump response (reused buffer)", N / 4, [&] {
+        auto [length, beLength] = codec.dump(response, buffer);
+        gSink = buffer.size() + length + beLength;
+    });
+
+    // 16 pipelined responses corked in one outbound buffer
+    bench("Codec: dumpFrame x16 (outbound queue)", N / 64, [&] {
+        buffer.clear();
+        for(int i = 0; i < 16; ++i) codec.dumpFrame(response, buffer);
+        gSink = buffer.size();
+    });
+
+    bench("Codec: makeRequest + dump", N / 4, [&] {
+        auto request = trpc::detail::makeRequest(19260817, "append", "jojo", "dio");
+        auto [dump, length, beLength] = codec.dump(request);
+        gSink = dump.size() + length + beLength;
+    });
+}
+
+int main() {
+#ifdef VSJSON_FLAT_OBJECT
+    std::cout << "ObjectImpl: flat" << std::endl;
+#else
+    std::cout << "ObjectImpl: std::map" << std::endl;
+#endif
+    benchCoroutine();
+    benchJson();
+    benchCodec();
+}
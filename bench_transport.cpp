@@ -0,0 +1,142 @@
+#include <bits/stdc++.h>
+#include <sys/wait.h>
+#include "trpc/Server.h"
+#include "trpc/Client.h"
+#include "trpc/Histogram.h"
+
+// round trip latency of a small call over each transport on this host,
+// and throughput of pipelined async calls on one connection
+//
+// g++ -std=c++17 -O2 -I base -I . bench_transport.cpp -o bench_transport -lpthread
+// usage: bench_transport [calls]
+
+using namespace std::chrono;
+
+struct Transport {
+    const char *name;
+    trpc::Endpoint endpoint;
+    // served by another process (not for in-process ones)
+    trpc::Endpoint remote;
+    // see Client::skipSerialization()
+    bool skipSerialization {};
+};
+
+// servers run in the same thread as the client, so a round trip has no thread switch
+// (and the numbers are comparable on a single core),
+// and then in another process, which is what shared memory is for
+void serve(co::Environment &env, trpc::Server &server) {
+    server.bind("add", [](int a, int b) { return a + b; });
+    env.createCoroutine([&server] { server.start(); })->resume();
+}
+
+trpc::Client connect(const trpc::Endpoint &endpoint) {
+    // the other process may not listen yet
+    std::optional<trpc::Client> client;
+    for(int retry = 0; retry < 100 && !client; ++retry) {
+        client = trpc::Client::make(endpoint);
+        if(!client) co::usleep(10000);
+    }
+    if(!client) {
+        std::cerr << "cannot connect to " << endpoint.toString() << std::endl;
+        ::_exit(1);
+    }
+    return std::move(*client);
+}
+
+void bench(const std::string &name, const trpc::Endpoint &endpoint, size_t calls, bool skipSerialization) {
+    auto client = std::make_optional(connect(endpoint));
+    client->skipSerialization(skipSerialization);
+    // warmup
+    for(size_t i = 0; i < calls / 10; ++i) client->call<int>("add", 1, 2);
+    trpc::Histogram latency;
+    auto start = steady_clock::now();
+    for(size_t i = 0; i < calls; ++i) {
+        auto t = steady_clock::now();
+        if(client->call<int>("add", 1, int(i)) != 1 + int(i)) {
+            std::cerr << name << ": call failed" << std::endl;
+            ::_exit(1);
+        }
+        latency.record(steady_clock::now() - t);
+    }
+    double seconds = duration<double>(steady_clock::now() - start).count();
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    std::cout << std::left << std::setw(28) << name
+              << "calls/s " << std::setw(10) << uint64_t(calls / seconds)
+              << "mean " << std::setw(8) << us(latency.mean())
+              << "p50 " << std::setw(8) << us(latency.percentile(0.5))
+              << "p99 " << std::setw(8) << us(latency.percentile(0.99))
+              << "max " << us(latency.max()) << " (us)" << std::endl;
+}
+
+// `depth` async calls in flight on one connection,
+// the server corks their responses into fewer writes (see detail::Outbound)
+void pipeline(const std::string &name, const trpc::Endpoint &endpoint, size_t calls, size_t depth) {
+    auto client = connect(endpoint);
+    std::vector<trpc::Future<int>> futures;
+    futures.reserve(depth);
+    auto start = steady_clock::now();
+    for(size_t i = 0; i < calls; i += depth) {
+        for(size_t j = 0; j < depth; ++j) futures.emplace_back(client.asyncCall<int>("add", 1, int(j)));
+        for(size_t j = 0; j < depth; ++j) {
+            if(futures[j].get() != 1 + int(j)) {
+                std::cerr << name << ": call failed" << std::endl;
+                ::_exit(1);
+            }
+        }
+        futures.clear();
+    }
+    double seconds = duration<double>(steady_clock::now() - start).count();
+    std::cout << std::left << std::setw(36) << name + (" depth " + std::to_string(depth))
+              << "calls/s " << uint64_t(calls / seconds) << std::endl;
+}
+
+int main(int argc, const char *argv[]) {
+    ::signal(SIGPIPE, SIG_IGN);
+    size_t calls = argc > 1 ? std::stoul(argv[1]) : 100000;
+    auto parse = [](const char *uri) { return *trpc::Endpoint::parse(uri); };
+    std::vector<Transport> transports {
+        {"tcp (loopback)", parse("tcp://127.0.0.1:2335"), parse("tcp://127.0.0.1:2336")},
+        {"unix (path)", parse("unix:///tmp/trpc_bench.sock"), parse("unix:///tmp/trpc_bench_remote.sock")},
+        {"unix (abstract)", parse("unix://@trpc_bench"), parse("unix://@trpc_bench_remote")},
+        {"shm (ring)", parse("shm://@trpc_bench_shm"), parse("shm://@trpc_bench_shm_remote")},
+        {"inproc (frames)", parse("inproc://bench"), parse("inproc://bench")},
+        {"inproc (trees)", parse("inproc://bench_trees"), parse("inproc://bench_trees"), true},
+    };
+    // the same servers in two processes
+    pid_t child = ::fork();
+    bool remote = child == 0;
+    auto &env = co::open();
+    std::vector<trpc::Server> servers;
+    servers.reserve(transports.size());
+    for(auto &transport : transports) {
+        auto &endpoint = remote ? transport.remote : transport.endpoint;
+        auto server = trpc::Server::make(endpoint);
+        if(!server) {
+            std::cerr << "cannot listen on " << endpoint.toString() << std::endl;
+            ::_exit(1);
+        }
+        servers.emplace_back(std::move(*server));
+        serve(env, servers.back());
+    }
+    if(!remote) env.createCoroutine([&] {
+        for(auto &transport : transports) {
+            bench(transport.name + std::string(" thread"), transport.endpoint, calls,
+                  transport.skipSerialization);
+        }
+        for(auto &transport : transports) {
+            if(transport.remote.inProcess) continue;
+            bench(transport.name + std::string(" process"), transport.remote, calls, false);
+        }
+        for(auto &transport : transports) {
+            if(transport.remote.inProcess) continue;
+            for(size_t depth : {1, 16, 128}) {
+                pipeline(transport.name + std::string(" process"), transport.remote, calls, depth);
+            }
+        }
+        ::kill(child, SIGKILL);
+        ::waitpid(child, nullptr, 0);
+        servers.clear();
+        ::_exit(0);
+    })->resume();
+    co::loop();
+}
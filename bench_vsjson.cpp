@@ -0,0 +1,175 @@
+#include <bits/stdc++.h>
+#include "vsjson.hpp"
+
+// g++ -std=c++17 -O2 -I base bench_vsjson.cpp -o bench_vsjson
+// g++ -std=c++17 -O2 -I base -DVSJSON_FLAT_OBJECT bench_vsjson.cpp -o bench_vsjson_flat
+
+using namespace std::chrono;
+
+// keep results alive
+volatile size_t gSink;
+
+template <typename Func>
+void bench(const char *name, size_t iterations, Func &&func) {
+    // warmup
+    for(size_t i = 0; i < iterations / 10; ++i) func();
+    auto start = steady_clock::now();
+    for(size_t i = 0; i < iterations; ++i) func();
+    auto end = steady_clock::now();
+    auto ns = duration<double, std::nano>{end - start}.count() / iterations;
+    std::cout << std::left << std::setw(32) << name << ns << " ns/op" << std::endl;
+}
+
+const std::string requestText =
+    R"({"jsonrpc":"2.0","id":19260817,"method":"append","params":["jojo","dio"]})";
+
+const std::string responseText =
+    R"({"jsonrpc":"2.0","id":19260817,"result":"jojodio"})";
+
+// number parser before from_chars, kept for comparison
+namespace legacy {
+
+int parseInteger(const char *&p) {
+    int i = 0;
+    while(isdigit(*p)) i = i*10 + (*p++ - '0');
+    return i;
+}
+
+double parseDecimal(const char *&p) {
+    ++p; // '.'
+    double d = 0, idx = 0.1;
+    while(isdigit(*p)) {
+        d += idx * (*p++ - '0');
+        idx *= 0.1;
+    }
+    return d;
+}
+
+double parseExponent(const char *&p) {
+    ++p; // e E
+    bool neg = (*p == '-');
+    if(*p == '+' || *p == '-') ++p;
+    double e = std::pow(10, parseInteger(p));
+    return !neg ? e : 1.0/e;
+}
+
+vsjson::Json parseNumber(const char *&p) {
+    bool neg = (*p == '-');
+    if(neg) ++p;
+    int integer = parseInteger(p);
+    if(*p != '.') return !neg ? integer : -integer;
+    double decimal = parseDecimal(p) + integer;
+    if(*p != 'e' && *p != 'E') return !neg ? decimal : -decimal;
+    double e = parseExponent(p);
+    return !neg ? e*decimal : -e*decimal;
+}
+
+} // legacy
+
+const std::vector<std::string> numberTexts {
+    "0", "7", "-42", "19260817", "2147483647",
+    "3.14159", "-0.5", "1.5e10", "2.718281828459045", "6.02e-23"
+};
+
+std::string makeWideText(size_t keys) {
+    std::string text = "{";
+    for(size_t i = 0; i < keys; ++i) {
+        if(i) text += ',';
+        text += "\"field_" + std::to_string(i) + "\":" + std::to_string(i);
+    }
+    return text + "}";
+}
+
+int main() {
+#ifdef VSJSON_FLAT_OBJECT
+    std::cout << "ObjectImpl: flat" << std::endl;
+#else
+    std::cout << "ObjectImpl: std::map" << std::endl;
+#endif
+
+    constexpr size_t N = 1 << 20;
+
+    bench("construct envelope", N, [] {
+        vsjson::Json json = {
+            {"jsonrpc", "2.0"},
+            {"id", 19260817},
+            {"method", "append"},
+            {"params", vsjson::Json::array()}
+        };
+        auto &params = json["params"];
+        params.append("jojo");
+        params.append("dio");
+        gSink = json.size();
+    });
+
+    bench("parse request", N, [] {
+        auto json = vsjson::parse(requestText);
+        gSink = json.size();
+    });
+
+    vsjson::Arena arena;
+    bench("parse request (arena)", N, [&] {
+        {
+            auto json = vsjson::parse(requestText, arena.resource());
+            gSink = json.size();
+        }
+        arena.reset();
+    });
+
+    bench("parse request (arena, view)", N, [&] {
+        {
+            auto json = vsjson::parseView(requestText.c_str(), arena.resource());
+            gSink = json.size();
+        }
+        arena.reset();
+    });
+
+    bench("index request (lazy)", N, [] {
+        vsjson::LazyObject lazy(requestText.c_str());
+        auto params = lazy.find("params");
+        gSink = lazy.size() + vsjson::LazyArray(params->begin).size();
+    });
+
+    auto request = vsjson::parse(requestText);
+    bench("lookup request fields", N, [&] {
+        size_t hits = request.contains("jsonrpc") + request.contains("id")
+            + request.contains("method") + request.contains("params");
+        gSink = hits;
+    });
+
+    auto response = vsjson::parse(responseText);
+    bench("lookup response fields", N, [&] {
+        size_t hits = response.contains("jsonrpc") + response.contains("id")
+            + response.contains("result") + response.contains("error");
+        gSink = hits;
+    });
+
+    auto wide = vsjson::parse(makeWideText(64));
+    bench("lookup 64-key object", N, [&] {
+        size_t hits = wide.contains("field_0") + wide.contains("field_31")
+            + wide.contains("field_63") + wide.contains("missing");
+        gSink = hits;
+    });
+
+    bench("parse numbers (legacy)", N, [] {
+        size_t sum = 0;
+        for(auto &text : numberTexts) {
+            const char *p = text.c_str();
+            sum += legacy::parseNumber(p).is<double>();
+        }
+        gSink = sum;
+    });
+
+    bench("parse numbers", N, [] {
+        size_t sum = 0;
+        for(auto &text : numberTexts) {
+            const char *p = text.c_str();
+            sum += vsjson::parser::parseNumberImpl(p).is<double>();
+        }
+        gSink = sum;
+    });
+
+    bench("dump request", N / 4, [&] {
+        gSink = request.dump().size();
+    });
+}
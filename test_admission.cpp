@@ -0,0 +1,84 @@
+#include <bits/stdc++.h>
+#include "trpc/Server.h"
+#include "trpc/Client.h"
+
+// admission control: a queued request is rejected once it waited too long,
+// even if no slot is ever released meanwhile (see detail::Admission)
+//
+// g++ -std=c++17 -O2 -I base -I . test_admission.cpp -o test_admission -lpthread
+// exit code 1 if any check fails
+
+using namespace std::chrono;
+
+constexpr uint16_t PORT = 2338;
+
+int failed = 0;
+
+void expect(const char *name, bool ok) {
+    std::cout << std::left << std::setw(44) << name << (ok ? "ok" : "FAILED") << std::endl;
+    if(!ok) failed++;
+}
+
+int main() {
+    ::signal(SIGPIPE, SIG_IGN);
+    auto &env = co::open();
+    auto server = trpc::Server::make({"127.0.0.1", PORT});
+    if(!server) {
+        std::cerr << "cannot listen on " << PORT << std::endl;
+        return 1;
+    }
+    // holds the only slot
+    server->bind("sleep", [](int ms) { co::usleep(ms * 1000); return ms; });
+    server->bind("add", [](int a, int b) { return a + b; });
+    trpc::Server::Limits limits;
+    limits.requests = 1;
+    limits.interval = milliseconds {50};
+    server->setLimits(limits);
+    env.createCoroutine([&] { server->start(); })->resume();
+
+    env.createCoroutine([&] {
+        auto holder = trpc::Client::make({"127.0.0.1", PORT});
+        auto waiter = trpc::Client::make({"127.0.0.1", PORT});
+        if(!holder || !waiter) {
+            std::cerr << "cannot connect to " << PORT << std::endl;
+            ::_exit(1);
+        }
+
+        using Attribute = trpc::detail::protocol::Attribute;
+        // a rejected request may be counted before its method is known
+        auto errors = [](int code) {
+            uint64_t count = 0;
+            for(auto &[_, method] : trpc::Stats::methods()) count += method.errors[code];
+            return count;
+        };
+
+        // the slot is held for 600ms, the queued call waits at most `interval`
+        auto held = holder->asyncCall<int>("sleep", 600);
+        auto start = steady_clock::now();
+        auto rejected = waiter->call<int>("add", 1, 2);
+        auto elapsed = steady_clock::now() - start;
+        expect("rejected without a release", !rejected && elapsed < milliseconds(300)
+            && errors(Attribute::overloadedCode) == 1);
+        expect("the slot holder is not disturbed", held.get() == 600);
+
+        // its own deadline is shorter than `interval`,
+        // the server drops it then (the caller has given up already)
+        limits.interval = milliseconds {1000};
+        server->setLimits(limits);
+        held = holder->asyncCall<int>("sleep", 600);
+        waiter->setTimeout(milliseconds {20});
+        auto late = waiter->call<int>("add", 3, 4);
+        waiter->setTimeout(trpc::Client::NO_TIMEDOUT);
+        co::usleep(100 * 1000);
+        expect("rejected at its deadline", !late && errors(Attribute::deadlineExceededCode) == 1);
+        held.get();
+
+        // released within `interval`, then admitted
+        auto shorter = holder->asyncCall<int>("sleep", 10);
+        expect("admitted after a release", waiter->call<int>("add", 5, 6) == 11 && shorter.get() == 10);
+
+        std::cout << (failed ? "FAILED" : "OK") << std::endl;
+        ::_exit(failed ? 1 : 0);
+    })->resume();
+    co::loop();
+}
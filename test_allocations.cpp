@@ -0,0 +1,101 @@
+#define TRPC_COUNT_ALLOCATIONS
+#include "trpc/detail/Allocations.h"
+#include <bits/stdc++.h>
+#include "trpc/Server.h"
+#include "trpc/Client.h"
+
+// steady state small RPCs of a lazy mode server (no onRequest / onResponse)
+// perform no heap allocation on the server thread
+//
+// g++ -std=c++17 -O2 -I base -I . test_allocations.cpp -o test_allocations -lpthread
+// exit code 1 if any request allocates
+
+constexpr uint16_t PORT = 2334;
+constexpr int WARMUP = 10;
+constexpr int REQUESTS = 30;
+
+std::atomic<bool> gReady {};
+
+void serverRoutine() {
+    auto &env = co::open();
+    auto server = trpc::Server::make({"127.0.0.1", PORT});
+    if(!server) {
+        std::cerr << "cannot listen on " << PORT << std::endl;
+        ::_exit(1);
+    }
+    server->bind("add", [](int a, int b) { return a + b; });
+    server->bind("length", [](std::string_view str) { return str.size(); });
+    // control case: it allocates, so counting is proven to work
+    server->bind("repeat", [](std::string_view str, int n) {
+        std::string result;
+        while(n--) result += str;
+        return result;
+    });
+    env.createCoroutine([&] {
+        gReady = true;
+        server->start();
+    })->resume();
+    co::loop();
+}
+
+// allocations of `method` per request on the server thread
+// (a request is recorded before its response is written, so the snapshot after a reply counts it)
+template <typename Call>
+double measure(const std::string &method, Call &&call) {
+    auto snapshot = [&] {
+        auto methods = trpc::Stats::methods();
+        auto &stats = methods[method];
+        return std::make_pair(stats.requests, stats.allocations);
+    };
+    for(int i = 0; i < WARMUP; ++i) call(i);
+    auto [requests, allocations] = snapshot();
+    for(int i = 0; i < REQUESTS; ++i) call(i);
+    auto [requests2, allocations2] = snapshot();
+    if(requests2 - requests != REQUESTS) {
+        std::cerr << method << ": " << requests2 - requests << " requests recorded" << std::endl;
+        ::_exit(1);
+    }
+    return double(allocations2 - allocations) / REQUESTS;
+}
+
+int main() {
+    ::signal(SIGPIPE, SIG_IGN);
+    std::thread {serverRoutine}.detach();
+    while(!gReady) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    auto &env = co::open();
+    env.createCoroutine([] {
+        auto client = trpc::Client::make({"127.0.0.1", PORT});
+        if(!client) {
+            std::cerr << "cannot connect to " << PORT << std::endl;
+            ::_exit(1);
+        }
+        int failed = 0;
+        auto expect = [&](const char *name, double allocations, bool zero) {
+            std::cout << std::left << std::setw(28) << name << allocations << " allocs/request" << std::endl;
+            if(zero != (allocations == 0)) failed++;
+        };
+        expect("add(int, int)", measure("add", [&](int i) {
+            if(client->call<int>("add", 1, i) != 1 + i) ::_exit(1);
+        }), true);
+        expect("length(string_view)", measure("length", [&](int) {
+            if(client->call<size_t>("length", "jojo") != 4) ::_exit(1);
+        }), true);
+        expect("notify add(int, int)", measure("add", [&](int i) {
+            if(!client->notify("add", 1, i)) ::_exit(1);
+            // answered in order, so the notification is done
+            client->call<int>("length", "");
+        }), true);
+        // integer method ids
+        if(!client->negotiate()) ::_exit(1);
+        expect("add(int, int) by id", measure("add", [&](int i) {
+            if(client->call<int>("add", 1, i) != 1 + i) ::_exit(1);
+        }), true);
+        expect("repeat(string_view, int)", measure("repeat", [&](int) {
+            if(!client->call<std::string>("repeat", "dio", 16)) ::_exit(1);
+        }), false);
+        std::cout << (failed ? "FAILED" : "OK") << std::endl;
+        ::_exit(failed ? 1 : 0);
+    })->resume();
+    co::loop();
+}
@@ -1,90 +1,330 @@
 #include <bits/stdc++.h>
 #include "trpc/Client.h"
+#include "trpc/Histogram.h"
+
+// load generator for test_server.cpp
+//
+// usage: test_client [--option=value ...]
+//   --ip=127.0.0.1 --port=2333
+//   --endpoint=uri       instead of ip and port: "tcp://ip:port",
+//                        a unix domain socket "unix:///path", "unix://@name",
+//                        or shared memory "shm:///path", "shm://@name"
+//   --threads=1          client threads
+//   --connections=1      connections per thread
+//   --mode=open          open: requests are sent at a fixed rate whether or not
+//                              the previous ones are answered, latency is measured
+//                              from the intended send time (no coordinated omission)
+//                        closed: each connection sends the next request after the
+//                                last response
+//   --rate=10000         requests per second of all threads (open loop)
+//   --warmup=1           seconds, not measured
+//   --duration=5         seconds
+//   --payload=16         bytes of the string echoed by "echo"
+//   --mix=add:1          methods and their weights, e.g. add:3,echo:1
+//   --format=text        or json (one line)
+//
+// compare transports or codecs by starting test_server.cpp in each mode
+// and running the same command line against it
 
 using namespace std::chrono;
+using Clock = steady_clock;
 
-std::atomic<int> gTODO {};
-std::atomic<system_clock::time_point> gStart {system_clock::now()};
-std::atomic<system_clock::time_point> gEnd {system_clock::now()};
+struct Options {
+    std::string ip {"127.0.0.1"};
+    uint16_t port {2333};
+    std::string endpoint;
+    int threads {1};
+    int connections {1};
+    std::string mode {"open"};
+    double rate {10000};
+    double warmup {1};
+    double duration {5};
+    size_t payload {16};
+    std::string mix {"add:1"};
+    std::string format {"text"};
+};
 
-void clientRoutine(int sessions, int startNumber, int numbers) {
-    ::signal(SIGPIPE, SIG_IGN);
-    auto &env = co::open();
-    int sum = startNumber;
-    int done = 0;
-    int sNumbers = numbers / sessions;
-    for(int i = 0; i < sessions; ++i) {
-        auto co = env.createCoroutine([&] {
-            trpc::Endpoint peer {"127.0.0.1", 2333};
-            auto pClient = trpc::Client::make(peer);
-            if(!pClient) {
-                std::cerr << "failed, abort" << std::endl;
-                return;
-            }
-            auto client = std::move(pClient.value());
-            for(size_t j = 0; j < sNumbers; ++j) {
-                int old = sum;
-                // add first, other clients won't send the same request
-                sum++;
-                auto resp = client.call<int>("add", old, 1);
-                if(old + 1 != resp.value()) {
-                    std::cerr << "failed at: " << i << ":" << j << std::endl;
-                }
-            }
+// measured requests of one thread
+struct Result {
+    trpc::Histogram latency;
+    std::atomic<uint64_t> sent {};
+    std::atomic<uint64_t> completed {};
+    std::atomic<uint64_t> failed {};
+    std::atomic<bool> done {};
+};
+
+Options gOptions;
+trpc::Endpoint gEndpoint;
+// weighted round robin, "add:3,echo:1" -> [add, add, add, echo]
+std::vector<std::string> gMix;
+std::string gPayload;
+Clock::time_point gStart, gMeasure, gEnd;
+
+Options parse(int argc, const char *argv[]) {
+    Options options;
+    std::map<std::string, std::string> kv;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto eq = arg.find('=');
+        if(arg.compare(0, 2, "--") || eq == std::string::npos) {
+            std::cerr << "bad option: " << arg << std::endl;
+            ::exit(1);
+        }
+        kv[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+    auto get = [&](const char *key, auto &value) {
+        auto iter = kv.find(key);
+        if(iter == kv.end()) return;
+        std::istringstream is {iter->second};
+        is >> value;
+        kv.erase(iter);
+    };
+    get("ip", options.ip);
+    get("port", options.port);
+    get("endpoint", options.endpoint);
+    get("threads", options.threads);
+    get("connections", options.connections);
+    get("mode", options.mode);
+    get("rate", options.rate);
+    get("warmup", options.warmup);
+    get("duration", options.duration);
+    get("payload", options.payload);
+    get("mix", options.mix);
+    get("format", options.format);
+    if(!kv.empty()) {
+        std::cerr << "unknown option: " << kv.begin()->first << std::endl;
+        ::exit(1);
+    }
+    return options;
+}
+
+std::vector<std::string> parseMix(const std::string &mix) {
+    std::vector<std::string> methods;
+    std::istringstream is {mix};
+    std::string item;
+    while(std::getline(is, item, ',')) {
+        auto colon = item.find(':');
+        auto name = item.substr(0, colon);
+        int weight = colon == std::string::npos ? 1 : std::stoi(item.substr(colon + 1));
+        if(name != "add" && name != "echo") {
+            std::cerr << "unknown method: " << name << std::endl;
+            ::exit(1);
+        }
+        methods.insert(methods.end(), weight, name);
+    }
+    return methods;
+}
+
+trpc::Future<vsjson::Json> asyncCall(trpc::Client &client, const std::string &method) {
+    if(method == "echo") return client.asyncCall<vsjson::Json>(method, std::as_const(gPayload));
+    return client.asyncCall<vsjson::Json>(method, 1, 2);
+}
+
+std::optional<vsjson::Json> call(trpc::Client &client, const std::string &method) {
+    if(method == "echo") return client.call<vsjson::Json>(method, std::as_const(gPayload));
+    return client.call<vsjson::Json>(method, 1, 2);
+}
+
+void sleepUntil(Clock::time_point when) {
+    while(1) {
+        auto us = duration_cast<microseconds>(when - Clock::now()).count();
+        // co::usleep(0) never wakes up
+        if(us <= 0) return;
+        co::usleep(std::min<int64_t>(us, 500000));
+    }
+}
+
+std::vector<trpc::Client> connect() {
+    std::vector<trpc::Client> clients;
+    for(int i = 0; i < gOptions.connections; ++i) {
+        auto client = trpc::Client::make(gEndpoint);
+        if(!client) {
+            std::cerr << "cannot connect to " << gEndpoint.toString() << std::endl;
+            ::exit(1);
+        }
+        clients.emplace_back(std::move(*client));
+    }
+    return clients;
+}
 
-            done++;
-            if(done == sessions) {
-                if(--gTODO == 0) {
-                    gEnd = system_clock::now();
-                    std::cout << "done, press any key" << std::endl;
-                }
+// one pacer per thread, requests are spread over the connections
+void openLoop(Result &result, int thread) {
+    // outlives the clients, failed calls are completed on close
+    uint64_t inflight = 0;
+    auto clients = connect();
+    nanoseconds interval {int64_t(1e9 * gOptions.threads / gOptions.rate)};
+    // threads are interleaved
+    auto first = gStart + interval * thread / gOptions.threads;
+    for(uint64_t i = 0; ; ++i) {
+        auto intended = first + interval * i;
+        if(intended >= gEnd) break;
+        sleepUntil(intended);
+        bool measured = intended >= gMeasure;
+        if(measured) result.sent++;
+        inflight++;
+        auto future = asyncCall(clients[i % clients.size()], gMix[i % gMix.size()]);
+        future.then([&result, &inflight, intended, measured](const std::optional<vsjson::Json> &response) {
+            inflight--;
+            if(!measured) return;
+            if(!response) {
+                result.failed++;
+                return;
             }
+            result.latency.record(Clock::now() - intended);
+            result.completed++;
         });
-        co->resume();
     }
+    // clients are closed after the responses (or the drain deadline)
+    while(inflight && Clock::now() < gEnd + seconds(5)) {
+        co::usleep(1000);
+    }
+}
 
-    co::loop();
+// one caller per connection
+void closedLoop(Result &result, trpc::Client &client, int connection) {
+    for(uint64_t i = connection; ; i += gOptions.connections) {
+        auto start = Clock::now();
+        if(start >= gEnd) break;
+        bool measured = start >= gMeasure;
+        if(measured) result.sent++;
+        auto response = call(client, gMix[i % gMix.size()]);
+        if(!measured) continue;
+        if(!response) {
+            result.failed++;
+            continue;
+        }
+        result.latency.record(Clock::now() - start);
+        result.completed++;
+    }
 }
 
-int main(int argc, const char *argv[]) {
-    int threads = 1;
-    if(argc > 1) {
-        threads = ::atoi(argv[1]);
+void clientRoutine(Result &result, int thread) {
+    ::signal(SIGPIPE, SIG_IGN);
+    auto &env = co::open();
+    if(gOptions.mode == "open") {
+        env.createCoroutine([&result, thread] {
+            openLoop(result, thread);
+            result.done = true;
+        })->resume();
+    } else {
+        env.createCoroutine([&result, &env] {
+            auto clients = connect();
+            int running = clients.size();
+            sleepUntil(gStart);
+            for(size_t i = 0; i < clients.size(); ++i) {
+                env.createCoroutine([&, i] {
+                    closedLoop(result, clients[i], i);
+                    if(--running == 0) result.done = true;
+                })->resume();
+            }
+            // keep the clients
+            while(running) co::usleep(100000);
+        })->resume();
     }
-    gTODO = threads;
+    co::loop();
+}
 
-    // per thread
-    int sessions = 1;
-    if(argc > 2) {
-        sessions = ::atoi(argv[2]);
+void report(std::vector<Result> &results) {
+    trpc::Histogram latency;
+    uint64_t sent = 0, completed = 0, failed = 0;
+    for(auto &result : results) {
+        latency.merge(result.latency);
+        sent += result.sent;
+        completed += result.completed;
+        failed += result.failed;
+    }
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    double throughput = completed / gOptions.duration;
+    if(gOptions.format == "json") {
+        vsjson::Json json {
+            {"endpoint", gEndpoint.toString()},
+            {"mode", std::string(gOptions.mode)},
+            {"threads", gOptions.threads},
+            {"connections", gOptions.threads * gOptions.connections},
+            {"rate", gOptions.mode == "open" ? gOptions.rate : 0.0},
+            {"duration", gOptions.duration},
+            {"payload", static_cast<uint64_t>(gOptions.payload)},
+            {"mix", std::string(gOptions.mix)},
+            {"sent", sent},
+            {"completed", completed},
+            {"failed", failed},
+            {"throughput", throughput},
+            {"latency", {
+                {"mean", us(latency.mean())},
+                {"p50", us(latency.percentile(0.5))},
+                {"p90", us(latency.percentile(0.9))},
+                {"p99", us(latency.percentile(0.99))},
+                {"p999", us(latency.percentile(0.999))},
+                {"max", us(latency.max())},
+            }},
+        };
+        std::cout << json.dump() << std::endl;
+        return;
     }
+    std::cout << "sent: " << sent << ", completed: " << completed << ", failed: " << failed << std::endl;
+    std::cout << "throughput: " << throughput << " req/s" << std::endl;
+    std::cout << "latency (us): "
+        << "mean " << us(latency.mean()) << ", "
+        << "p50 " << us(latency.percentile(0.5)) << ", "
+        << "p90 " << us(latency.percentile(0.9)) << ", "
+        << "p99 " << us(latency.percentile(0.99)) << ", "
+        << "p999 " << us(latency.percentile(0.999)) << ", "
+        << "max " << us(latency.max()) << std::endl;
+}
 
-    // total
-    int count = 1 << 16;
-    if(argc > 3) {
-        count = ::atoi(argv[3]);
+int main(int argc, const char *argv[]) {
+    gOptions = parse(argc, argv);
+    gMix = parseMix(gOptions.mix);
+    gPayload.assign(gOptions.payload, 'x');
+    if(gOptions.endpoint.empty()) {
+        gEndpoint = {gOptions.ip, gOptions.port};
+    } else if(auto endpoint = trpc::Endpoint::parse(gOptions.endpoint)) {
+        gEndpoint = *endpoint;
+    } else {
+        std::cerr << "bad endpoint: " << gOptions.endpoint << std::endl;
+        return 1;
+    }
+    if(gMix.empty() || gOptions.threads < 1 || gOptions.connections < 1
+            || (gOptions.mode != "open" && gOptions.mode != "closed") || gOptions.rate <= 0) {
+        std::cerr << "bad options" << std::endl;
+        return 1;
     }
 
-    std::cout << "start test: " << '{'
-        << "threads: " << threads << ", "
-        << "per thread sessions: " << sessions << ", "
-        << "total sessions: " << threads * sessions << ", "
-        << "count: " << count << '}' << std::endl;
+    if(gOptions.format == "text") {
+        std::cout << "start test: " << '{'
+            << "endpoint: " << gEndpoint.toString() << ", "
+            << "mode: " << gOptions.mode << ", "
+            << "threads: " << gOptions.threads << ", "
+            << "total connections: " << gOptions.threads * gOptions.connections << ", "
+            << (gOptions.mode == "open" ? "rate: " + std::to_string(gOptions.rate) + ", " : "")
+            << "payload: " << gOptions.payload << ", "
+            << "mix: " << gOptions.mix << '}' << std::endl;
+    }
 
-    gStart = system_clock::now();
+    // time to connect
+    gStart = Clock::now() + milliseconds(100);
+    gMeasure = gStart + duration_cast<Clock::duration>(duration<double>(gOptions.warmup));
+    gEnd = gMeasure + duration_cast<Clock::duration>(duration<double>(gOptions.duration));
 
-    for(int i = 0; i < threads; ++i) {
-        std::thread {clientRoutine, sessions, i * count, count / threads}.detach();
+    std::vector<Result> results(gOptions.threads);
+    for(int i = 0; i < gOptions.threads; ++i) {
+        std::thread {clientRoutine, std::ref(results[i]), i}.detach();
     }
 
-    // hang
-    int c; std::cin>>c;
-
-    using Milli = duration<double, std::milli>;
-    auto perMsg = Milli{gEnd.load() - gStart.load()}.count() / count;
-    auto qps = 1000 / perMsg;
-    std::cout << "per msg: " << perMsg << "ms" << std::endl;
-    std::cout << "QPS: " << qps << std::endl;
+    auto allDone = [&] {
+        return std::all_of(results.begin(), results.end(), [](auto &r) { return r.done.load(); });
+    };
+    while(!allDone() && Clock::now() < gEnd + seconds(10)) {
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+    if(!allDone()) {
+        // e.g. still connecting
+        std::cerr << "client threads did not finish" << std::endl;
+        ::_exit(1);
+    }
 
-    return 0;
-}
\ No newline at end of file
+    report(results);
+    std::cout.flush();
+    // client threads never return from co::loop()
+    ::_exit(0);
+}
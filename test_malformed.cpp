@@ -0,0 +1,103 @@
+#include <bits/stdc++.h>
+#include "trpc/Server.h"
+
+// malformed request frames are answered with Parse error (-32700),
+// and never run a method (see vsjson::parser::skipValue)
+// neither do params out of range of their argument type, Invalid params (-32602)
+//
+// g++ -std=c++17 -O2 -I base -I . test_malformed.cpp -o test_malformed -lpthread
+// exit code 1 if any check fails
+
+constexpr uint16_t PORT = 2339;
+
+int failed = 0;
+
+void expect(const std::string &name, bool ok) {
+    std::cout << std::left << std::setw(72) << name << (ok ? "ok" : "FAILED") << std::endl;
+    if(!ok) failed++;
+}
+
+// a raw frame over a blocking socket, the reply text
+std::string roundTrip(int fd, const std::string &text) {
+    uint32_t length = htonl(text.size());
+    std::string frame(reinterpret_cast<const char*>(&length), sizeof length);
+    frame += text;
+    if(::write(fd, frame.data(), frame.size()) != ssize_t(frame.size())) return {};
+    auto readAll = [fd](char *buf, size_t size) {
+        for(size_t done = 0; done < size;) {
+            auto n = ::read(fd, buf + done, size - done);
+            if(n <= 0) return false;
+            done += n;
+        }
+        return true;
+    };
+    if(!readAll(reinterpret_cast<char*>(&length), sizeof length)) return {};
+    std::string reply(ntohl(length), '\0');
+    if(!readAll(reply.data(), reply.size())) return {};
+    return reply;
+}
+
+int main() {
+    ::signal(SIGPIPE, SIG_IGN);
+    auto &env = co::open();
+    auto server = trpc::Server::make({"127.0.0.1", PORT});
+    if(!server) {
+        std::cerr << "cannot listen on " << PORT << std::endl;
+        return 1;
+    }
+    std::atomic<int> calls {0};
+    server->bind("add", [&](int a, int b) { calls++; return a + b; });
+    env.createCoroutine([&] { server->start(); })->resume();
+
+    // the server runs in this thread
+    std::thread client([&] {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(PORT);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr)) {
+            std::cerr << "cannot connect to " << PORT << std::endl;
+            ::_exit(1);
+        }
+
+        auto parseError = [](const std::string &reply) {
+            return reply.find("-32700") != std::string::npos;
+        };
+        const std::string head = R"({"jsonrpc":"2.0","id":1,"method":"add","params":)";
+        const std::vector<std::string> malformed {
+            R"({"jsonrpc":"2.0","id":,"method":"add","params":[1,2]})",
+            head + "[1,2]}garbage",
+            head + "[1,]}",
+            head + "[tru]}",
+            head + "[1 2]}",
+            head + "[01,2]}",
+            head + "[1.,2]}",
+            head + "[-,2]}",
+            head + "[1,2],}",
+            R"([{"jsonrpc":"2.0","id":1,"method":"add","params":[1,2]}] [])",
+        };
+        for(auto &text : malformed) {
+            int before = calls;
+            auto reply = roundTrip(fd, text);
+            expect(text, parseError(reply) && calls == before);
+        }
+
+        for(auto params : {"[4294967297,2]", "[-2147483649,2]", "[1e10,2]"}) {
+            int before = calls;
+            auto reply = roundTrip(fd, head + params + "}");
+            expect(head + params + "}", reply.find("-32602") != std::string::npos && calls == before);
+        }
+
+        auto reply = roundTrip(fd, head + "[1,2]} \n");
+        expect("well-formed after them", reply.find(R"("result":3)") != std::string::npos);
+        reply = roundTrip(fd, head + "[-0.5e1,2E+0]}");
+        expect("well-formed numbers", !reply.empty() && !parseError(reply));
+
+        ::close(fd);
+        std::cout << (failed ? "FAILED" : "OK") << std::endl;
+        ::_exit(failed ? 1 : 0);
+    });
+    client.detach();
+    co::loop();
+}
@@ -0,0 +1,77 @@
+#include <bits/stdc++.h>
+#include "trpc/Server.h"
+#include "trpc/Client.h"
+
+// pipelined calls on one connection: responses are corked by the server (see detail::Outbound),
+// but a corked response is not held by a slow call behind it
+//
+// g++ -std=c++17 -O2 -I base -I . test_pipeline.cpp -o test_pipeline -lpthread
+// exit code 1 if any check fails
+
+using namespace std::chrono;
+
+constexpr uint16_t PORT = 2337;
+
+int failed = 0;
+
+void expect(const char *name, bool ok) {
+    std::cout << std::left << std::setw(44) << name << (ok ? "ok" : "FAILED") << std::endl;
+    if(!ok) failed++;
+}
+
+int main() {
+    ::signal(SIGPIPE, SIG_IGN);
+    auto &env = co::open();
+    auto server = trpc::Server::make({"127.0.0.1", PORT});
+    if(!server) {
+        std::cerr << "cannot listen on " << PORT << std::endl;
+        return 1;
+    }
+    server->bind("add", [](int a, int b) { return a + b; });
+    server->bind("repeat", [](int n) { return std::string(n, 'r'); });
+    // yields, like a handler waiting for another service
+    server->bind("sleep", [](int ms) { co::usleep(ms * 1000); return ms; });
+    env.createCoroutine([&] { server->start(); })->resume();
+
+    env.createCoroutine([&] {
+        auto client = trpc::Client::make({"127.0.0.1", PORT});
+        if(!client) {
+            std::cerr << "cannot connect to " << PORT << std::endl;
+            ::_exit(1);
+        }
+
+        bool ok = true;
+        for(int depth : {1, 16, 200}) {
+            std::vector<trpc::Future<int>> futures;
+            for(int i = 0; i < depth; ++i) futures.emplace_back(client->asyncCall<int>("add", 1, i));
+            for(int i = 0; i < depth; ++i) ok &= futures[i].get() == 1 + i;
+        }
+        expect("pipelined replies in order", ok);
+
+        // over Outbound::MAX_BYTES
+        ok = true;
+        std::vector<trpc::Future<std::string>> large;
+        for(int i = 0; i < 20; ++i) large.emplace_back(client->asyncCall<std::string>("repeat", 5000 + i));
+        for(int i = 0; i < 20; ++i) ok &= large[i].get() == std::string(5000 + i, 'r');
+        expect("pipelined large replies", ok);
+
+        // the first reply is corked (the second request is readable),
+        // and flushed by the cork timer while the second handler sleeps
+        auto start = steady_clock::now();
+        auto fast = client->asyncCall<int>("add", 2, 2);
+        auto slow = client->asyncCall<int>("sleep", 300);
+        bool fastOk = fast.get() == 4;
+        auto fastElapsed = steady_clock::now() - start;
+        bool slowOk = slow.get() == 300;
+        expect("slow second call does not hold the first", fastOk && slowOk && fastElapsed < milliseconds(100));
+
+        // a reply seen by the client is already counted
+        auto before = trpc::Stats::methods()["add"].requests;
+        client->call<int>("add", 3, 3);
+        expect("counted before replied", trpc::Stats::methods()["add"].requests == before + 1);
+
+        std::cout << (failed ? "FAILED" : "OK") << std::endl;
+        ::_exit(failed ? 1 : 0);
+    })->resume();
+    co::loop();
+}
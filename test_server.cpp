@@ -1,13 +1,59 @@
 #include <bits/stdc++.h>
 #include "trpc/Server.h"
 
+// usage: test_server [--threads=1] [--port=2333] [--endpoint=uri] [--eager]
+//   --endpoint: listen on "tcp://ip:port", "[::]:port" (IPv6 and IPv4), a unix domain socket ("unix:///path", "unix://@name")
+//               or shared memory ("shm:///path", "shm://@name")
+//               instead of 127.0.0.1:port, a unix domain socket has only one thread
+//   --eager: decode the whole request before dispatch (onRequest mode),
+//            instead of the lazy top level scan
+// see test_client.cpp for the load generator
+
 std::string append(std::string a, std::string b) {
     return a+b;
 }
 
+struct Options {
+    int threads {1};
+    uint16_t port {2333};
+    std::optional<trpc::Endpoint> endpoint;
+    bool eager {false};
+};
+
+Options gOptions;
+
+Options parse(int argc, const char *argv[]) {
+    Options options;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(arg.compare(0, 10, "--threads=") == 0) {
+            options.threads = std::stoi(arg.substr(10));
+        } else if(arg.compare(0, 7, "--port=") == 0) {
+            options.port = std::stoi(arg.substr(7));
+        } else if(arg.compare(0, 11, "--endpoint=") == 0) {
+            options.endpoint = trpc::Endpoint::parse(arg.substr(11));
+            if(!options.endpoint) {
+                std::cerr << "bad endpoint: " << arg << std::endl;
+                ::exit(1);
+            }
+        } else if(arg == "--eager") {
+            options.eager = true;
+        } else {
+            std::cerr << "bad option: " << arg << std::endl;
+            ::exit(1);
+        }
+    }
+    // SO_REUSEPORT is for TCP only
+    if(options.endpoint && options.endpoint->family() == AF_UNIX && options.threads > 1) {
+        std::cerr << "a unix domain socket has only one thread" << std::endl;
+        ::exit(1);
+    }
+    return options;
+}
+
 void serverRoutine() {
     ::signal(SIGPIPE, SIG_IGN);
-    auto pServer = trpc::Server::make({"127.0.0.1", 2333});
+    auto pServer = trpc::Server::make(gOptions.endpoint.value_or(trpc::Endpoint {"127.0.0.1", gOptions.port}));
     std::cout << bool(pServer) << std::endl;
     if(!pServer) {
         std::cerr << "cannot create server." << std::endl;
@@ -17,6 +63,11 @@ void serverRoutine() {
 
     server.bind("add", [](int a, int b) { return a + b; });
     server.bind("append", append);
+    server.bind("echo", [](std::string s) { return s; });
+
+    if(gOptions.eager) {
+        server.onRequest([](auto &&) { return true; });
+    }
 
     auto &env = co::open();
     auto listener = env.createCoroutine([&server] {
@@ -27,11 +78,8 @@ void serverRoutine() {
 }
 
 int main(int argc, const char *argv[]) {
-    int threads = 1;
-    if(argc > 1) {
-        threads = ::atoi(argv[1]);
-    }
-    for(int i = 1; i < threads; ++i) {
+    gOptions = parse(argc, argv);
+    for(int i = 1; i < gOptions.threads; ++i) {
         std::thread {serverRoutine}.detach();
     }
     serverRoutine();
@@ -19,10 +19,21 @@ struct Mock {
     size_t packetLimit; // [0, packetLimit) bytes
 };
 
-trpc::Endpoint local {"127.0.0.1", 2334};
+// usage: test_unreliable [endpoint]
+// the server is in this thread, so it needs no socket by default
+// (e.g. "tcp://127.0.0.1:2334" to go through the network stack)
+trpc::Endpoint local = *trpc::Endpoint::parse("inproc://unreliable");
 
 int main(int argc, const char *argv[]) {
     ::signal(SIGPIPE, SIG_IGN);
+    if(argc > 1) {
+        auto endpoint = trpc::Endpoint::parse(argv[1]);
+        if(!endpoint) {
+            std::cerr << "bad endpoint: " << argv[1] << std::endl;
+            return 1;
+        }
+        local = *endpoint;
+    }
     auto &env = co::open();
 
 
@@ -0,0 +1,409 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "co.hpp"
+#include "Client.h"
+#include "Deadline.h"
+#include "Endpoint.h"
+#include "Future.h"
+#include "RetryPolicy.h"
+#include "detail/Retry.h"
+namespace trpc {
+
+// a pool of clients over a set of endpoints
+//
+// - connections are made on demand, up to `connections` per endpoint,
+//   and kept warm for calls from any coroutine
+// - every call picks an endpoint by `balance`
+// - an endpoint failed `maxFailures` times in a row is ejected for `ejection`,
+//   unless every endpoint is ejected
+// - calls to idempotent methods may be retried or hedged, see RetryPolicy
+//
+// all coroutines using a channel must be in the same thread (co::Environment),
+// and the channel must outlive the calls (a hedged call may finish after it returns)
+class Channel {
+public:
+
+    enum class Balance {
+        // power of two choices: the less loaded of two random endpoints
+        POWER_OF_TWO_CHOICES,
+        // scan all endpoints for the least outstanding requests
+        LEAST_OUTSTANDING,
+    };
+
+    struct Options {
+        size_t                    connections {4};
+        Balance                   balance {Balance::POWER_OF_TWO_CHOICES};
+        size_t                    maxFailures {3};
+        std::chrono::milliseconds ejection {std::chrono::seconds {1}};
+        std::chrono::milliseconds timeout {Client::NO_TIMEDOUT};
+        RetryPolicy               retry;
+    };
+
+// call
+public:
+
+    // the same as Client::call()
+    // waits (yield) if all the connections of the picked endpoint are busy
+    template <typename T, typename ...Args>
+    std::optional<T> call(const std::string &function, Args &&...arguments);
+
+    // the same as Client::notify()
+    template <typename ...Args>
+    bool notify(const std::string &function, Args &&...arguments);
+
+    // last errno of any connection
+    int error();
+
+// class attributes
+public:
+
+    // no connection is made here
+    explicit Channel(std::vector<Endpoint> endpoints);
+    Channel(std::vector<Endpoint> endpoints, Options options);
+
+    Channel(const Channel&) = delete;
+    Channel(Channel&&) = default;
+    Channel& operator=(Channel&&) = default;
+
+    size_t size() const { return _peers.size(); }
+
+private:
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Peer {
+        Endpoint endpoint;
+        // warm connections, the most recently used one at the back
+        std::vector<std::unique_ptr<Client>> idle;
+        // idle + busy
+        size_t connections {};
+        // calls in flight (including the waiting ones)
+        size_t outstanding {};
+        // consecutive failures
+        size_t failures {};
+        Clock::time_point ejectedUntil {};
+        // coroutines waiting for a connection
+        std::deque<std::shared_ptr<co::Coroutine>> waiters;
+
+        Peer() = default;
+        Peer(const Peer&) = delete;
+        Peer(Peer&&) = default;
+    };
+
+    // `avoid` is not picked unless it is the only choice
+    Peer& pick(const Peer *avoid = nullptr);
+
+    // nullptr if failed to connect, or `dropped` while waiting for a connection
+    std::unique_ptr<Client> acquire(Peer &peer, const Promise<bool> *dropped = nullptr);
+
+    // put back a connection (or drop it if broken) and update health
+    // an `abandoned` call (the loser of a hedge) is not a success,
+    // failures are counted only if the connection failed
+    void release(Peer &peer, std::unique_ptr<Client> client, bool abandoned = false);
+
+    // on a picked endpoint
+    template <typename Func>
+    auto invoke(Func &&func) -> decltype(func(std::declval<Client&>()));
+
+    template <typename Func>
+    auto invoke(Peer &peer, Func &&func, const Promise<bool> *dropped = nullptr)
+        -> decltype(func(std::declval<Client&>()));
+
+    // call of idempotent method: retry and hedging
+    template <typename T, typename ...Args>
+    std::optional<T> retryCall(const std::string &function, const Args &...arguments);
+
+    // one attempt, with a backup request if hedging
+    template <typename T, typename ...Args>
+    std::optional<T> hedgedCall(Peer &peer, const std::string &function, const Args &...arguments);
+
+    // run an attempt in its own coroutine
+    // once `dropped` is set, it gives back its connection (or its place in the queue) at once,
+    // the budget of a `backup` is given back too if it is not sent yet
+    template <typename T, typename ...Args>
+    Future<T> launch(Peer &peer, Promise<bool> dropped, bool backup,
+                     const std::string &function, const Args &...arguments);
+
+private:
+    std::vector<Peer> _peers;
+    Options           _options;
+    std::minstd_rand  _random;
+    int               _errno {};
+
+    detail::RetryBudget _budget;
+    // method -> latency, for hedging delay
+    std::unordered_map<std::string, detail::LatencyWindow> _latencies;
+};
+
+template <typename T, typename ...Args>
+inline std::optional<T> Channel::call(const std::string &function, Args &&...arguments) {
+    if(!_peers.empty() && _options.retry.idempotent.count(function)) {
+        // arguments may be sent more than once
+        return retryCall<T>(function, static_cast<const std::decay_t<Args>&>(arguments)...);
+    }
+    return invoke([&](Client &client) {
+        return client.call<T>(function, std::forward<Args>(arguments)...);
+    });
+}
+
+template <typename ...Args>
+inline bool Channel::notify(const std::string &function, Args &&...arguments) {
+    return invoke([&](Client &client) {
+        return client.notify(function, std::forward<Args>(arguments)...);
+    });
+}
+
+inline int Channel::error() {
+    int err = _errno;
+    _errno = 0;
+    return err;
+}
+
+inline Channel::Channel(std::vector<Endpoint> endpoints)
+    : Channel(std::move(endpoints), Options())
+{}
+
+inline Channel::Channel(std::vector<Endpoint> endpoints, Options options)
+    : _options(std::move(options)),
+      _random(std::random_device{}()),
+      _budget(_options.retry.budgetRatio, _options.retry.budgetReserve)
+{
+    _peers.resize(endpoints.size());
+    for(size_t i = 0; i < endpoints.size(); ++i) {
+        _peers[i].endpoint = endpoints[i];
+    }
+    _options.connections = std::max<size_t>(1, _options.connections);
+}
+
+template <typename Func>
+inline auto Channel::invoke(Func &&func) -> decltype(func(std::declval<Client&>())) {
+    if(_peers.empty()) {
+        _errno = EINVAL;
+        return {};
+    }
+    return invoke(pick(), std::forward<Func>(func));
+}
+
+template <typename Func>
+inline auto Channel::invoke(Peer &peer, Func &&func, const Promise<bool> *dropped)
+    -> decltype(func(std::declval<Client&>()))
+{
+    peer.outstanding++;
+    auto client = acquire(peer, dropped);
+    if(!client) {
+        peer.outstanding--;
+        return {};
+    }
+    auto result = func(*client);
+    peer.outstanding--;
+    // given up for the other attempt, see launch()
+    release(peer, std::move(client), dropped && dropped->ready());
+    return result;
+}
+
+template <typename T, typename ...Args>
+inline std::optional<T> Channel::retryCall(const std::string &function, const Args &...arguments) {
+    _budget.deposit();
+    const Peer *failed = nullptr;
+    for(size_t attempts = 1; ; ++attempts) {
+        auto &peer = pick(failed);
+        auto result = hedgedCall<T>(peer, function, arguments...);
+        if(result || attempts >= _options.retry.maxAttempts
+                || Deadline::current() <= Deadline::Clock::now()
+                || !_budget.withdraw()) {
+            return result;
+        }
+        failed = &peer;
+    }
+}
+
+template <typename T, typename ...Args>
+inline std::optional<T> Channel::hedgedCall(Peer &peer, const std::string &function, const Args &...arguments) {
+    auto &policy = _options.retry;
+    auto &latency = _latencies[function];
+    auto delay = policy.hedging && _peers.size() > 1 && co::test() ?
+        latency.percentile(policy.percentile) : std::nullopt;
+    if(!delay) {
+        return invoke(peer, [&](Client &client) {
+            auto start = Clock::now();
+            auto result = client.call<T>(function, arguments...);
+            if(result && policy.hedging) latency.add(Clock::now() - start);
+            return result;
+        });
+    }
+
+    Promise<bool> dropped;
+    auto primary = launch<T>(peer, dropped, false, function, arguments...);
+
+    // wait for the primary one, or the hedging delay
+    Promise<bool> wake;
+    primary.then([wake](auto &&) mutable { wake.set(true); });
+    if(!primary.ready()) {
+        auto until = Clock::now() + std::max<Clock::duration>(*delay, policy.minDelay);
+        // entry of coroutine is const
+        co::open().createCoroutine([wake, until] {
+            using namespace std::chrono;
+            // co::usleep() is less than a second
+            constexpr microseconds MAX_SLEEP = seconds {1} - microseconds {1};
+            for(auto now = Clock::now(); now < until && !wake.ready(); now = Clock::now()) {
+                auto wait = ceil<microseconds>(until - now);
+                co::usleep(std::clamp(wait, microseconds {1}, MAX_SLEEP).count());
+            }
+            Promise<bool>(wake).set(false);
+        })->resume();
+    }
+    wake.future().get();
+    if(primary.ready() || !_budget.withdraw()) {
+        return primary.get();
+    }
+
+    auto &other = pick(&peer);
+    if(&other == &peer) {
+        return primary.get();
+    }
+    auto backup = launch<T>(other, dropped, true, function, arguments...);
+    auto winner = whenAny(std::vector<Future<T>> {primary, backup}).get();
+    // the loser is dropped: a backup still waiting for a connection is never sent,
+    // or else its connection is put back at once and its response is discarded when it comes
+    dropped.set(true);
+    if(!winner) {
+        return std::nullopt;
+    }
+    return *winner == 0 ? primary.get() : backup.get();
+}
+
+template <typename T, typename ...Args>
+inline Future<T> Channel::launch(Peer &peer, Promise<bool> dropped, bool backup,
+                                 const std::string &function, const Args &...arguments) {
+    Promise<T> promise;
+    auto future = promise.future();
+    // it may outlive the caller, so everything is copied
+    auto deadline = Deadline::current();
+    auto attempt = [=, &peer] {
+        std::optional<Deadline> scope;
+        if(deadline != Deadline::NEVER) scope.emplace(deadline);
+        bool sent = false;
+        auto result = invoke(peer, [&](Client &client) -> std::optional<T> {
+            if(dropped.ready()) return std::nullopt;
+            auto start = Clock::now();
+            auto call = client.asyncCall<T>(function, arguments...);
+            sent = true;
+            // woken by the response, or by the winner of the other attempt
+            Promise<bool> wake;
+            call.then([wake](auto &&) mutable { wake.set(true); });
+            dropped.future().then([wake](auto &&) mutable { wake.set(false); });
+            wake.future().get();
+            // not ready if dropped: the connection is put back with the call in flight
+            if(!call.ready()) return std::nullopt;
+            auto result = call.get();
+            if(result) _latencies[function].add(Clock::now() - start);
+            return result;
+        }, &dropped);
+        if(backup && !sent) _budget.refund();
+        Promise<T>(promise).set(std::move(result));
+    };
+    auto coroutine = co::open().createCoroutine(std::move(attempt));
+    // still waiting for a connection when dropped, taken out of the queue
+    dropped.future().then([&peer, weak = std::weak_ptr<co::Coroutine>(coroutine)](auto &&) {
+        auto coroutine = weak.lock();
+        if(!coroutine) return;
+        auto iter = std::find(peer.waiters.begin(), peer.waiters.end(), coroutine);
+        if(iter == peer.waiters.end()) return;
+        peer.waiters.erase(iter);
+        coroutine->resume();
+    });
+    coroutine->resume();
+    return future;
+}
+
+inline Channel::Peer& Channel::pick(const Peer *avoid) {
+    auto now = Clock::now();
+    // `avoid` makes sense only if there is another choice
+    if(_peers.size() < 2) avoid = nullptr;
+    auto available = [&](const Peer &peer) { return peer.ejectedUntil <= now && &peer != avoid; };
+    size_t candidates = std::count_if(_peers.begin(), _peers.end(), available);
+    // panic mode: all ejected, then ejection is meaningless
+    bool panic = (candidates == 0);
+    if(panic) candidates = _peers.size();
+    auto nth = [&](size_t n) -> Peer& {
+        for(auto &peer : _peers) {
+            if((panic || available(peer)) && n-- == 0) return peer;
+        }
+        return _peers.back();
+    };
+
+    if(_options.balance == Balance::POWER_OF_TWO_CHOICES) {
+        std::uniform_int_distribution<size_t> dist(0, candidates - 1);
+        auto &lhs = nth(dist(_random));
+        auto &rhs = nth(dist(_random));
+        return lhs.outstanding <= rhs.outstanding ? lhs : rhs;
+    }
+    Peer *least = nullptr;
+    for(auto &peer : _peers) {
+        if(!panic && !available(peer)) continue;
+        if(!least || peer.outstanding < least->outstanding) least = &peer;
+    }
+    return *least;
+}
+
+inline std::unique_ptr<Client> Channel::acquire(Peer &peer, const Promise<bool> *dropped) {
+    while(peer.idle.empty() && peer.connections >= _options.connections) {
+        peer.waiters.emplace_back(co::Coroutine::current().shared_from_this());
+        co::this_coroutine::yield();
+        // resumed out of the queue, see launch()
+        if(dropped && dropped->ready()) return nullptr;
+    }
+    if(!peer.idle.empty()) {
+        auto client = std::move(peer.idle.back());
+        peer.idle.pop_back();
+        return client;
+    }
+    peer.connections++;
+    auto client = std::make_unique<Client>();
+    client->init();
+    if(!client->error() && client->connect(peer.endpoint)) {
+        client->setTimeout(_options.timeout);
+        return client;
+    }
+    _errno = client->error();
+    // nullptr is a broken connection
+    release(peer, nullptr);
+    return nullptr;
+}
+
+inline void Channel::release(Peer &peer, std::unique_ptr<Client> client, bool abandoned) {
+    // a timed out call doesn't break the connection (its response is skipped later by id),
+    // but still counts as a failure of endpoint
+    int err = client ? client->error() : _errno;
+    bool broken = !client || !client->available();
+    if(err || broken) {
+        if(err) _errno = err;
+        if(++peer.failures >= _options.maxFailures) {
+            peer.ejectedUntil = Clock::now() + _options.ejection;
+        }
+    } else if(!abandoned) {
+        // an abandoned call has no answer yet, the endpoint may still be the slow one
+        peer.failures = 0;
+    }
+    if(broken) {
+        peer.connections--;
+    } else {
+        peer.idle.emplace_back(std::move(client));
+    }
+    if(!peer.waiters.empty()) {
+        auto waiter = std::move(peer.waiters.front());
+        peer.waiters.pop_front();
+        waiter->resume();
+    }
+}
+
+} // trpc
@@ -2,17 +2,26 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <algorithm>
+#include <functional>
 #include <optional>
 #include <chrono>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include "co.hpp"
 #include "detail/Codec.h"
 #include "detail/resolve.h"
 #include "detail/TokenGenerator.h"
 #include "detail/bestEffort.h"
-#include "detail/Health.h"
+#include "detail/RingStream.h"
+#include "detail/Loopback.h"
+#include "detail/Buffer.h"
+#include "Deadline.h"
 #include "Endpoint.h"
+#include "Future.h"
 namespace trpc {
 
 class Client {
@@ -28,18 +37,75 @@ public:
     template <typename T, typename ...Args>
     std::optional<T> call(const std::string &function, Args &&...arguemnts);
 
-    // global client timeout
+    // write the request and return at once
+    //
+    // responses are read by a reader coroutine of this client (started on demand),
+    // which completes the futures by response id, so many calls can be in flight
+    // on one connection without a coroutine for each
+    //
+    //     std::vector<trpc::Future<int>> futures;
+    //     for(auto &&shard : shards) futures.emplace_back(client.asyncCall<int>("count", shard));
+    //     trpc::whenAll(futures).then([](auto &&counts) { ... });
+    //
+    // call() also goes through the reader while any async call is in flight,
+    // batch() and negotiate() fail with EBUSY then
+    //
+    // a client can be moved with calls in flight, and closing (or destroying) it fails them at once
+    template <typename T, typename ...Args>
+    Future<T> asyncCall(const std::string &function, Args &&...arguments);
+
+    // fire-and-forget (JSON-RPC notification)
+    // only writes the request, server never replies, and remote errors are lost
+    //
+    // true if the request is written
+    template <typename ...Args>
+    bool notify(const std::string &function, Args &&...arguments);
+
+    // JSON-RPC batch: many calls in one frame and one round trip
+    //
+    //     auto results = client.batch()
+    //         .call("add", 1, 2)
+    //         .call("append", "jojo", "dio")
+    //         .send();
+    //     std::optional<int> sum = results[0] ? results[0]->to<int>() : std::nullopt;
+    class Batch;
+    Batch batch();
+
+    // opt-in handshake: fetch the method table of server (rpc.methods) once,
+    // later calls to these methods send an integer method id instead of the name
+    //
+    // false if failed, calls still work by name
+    // (EBUSY while async calls are in flight, see asyncCall())
+    bool negotiate();
+
+    // default budget of every call (the whole round trip)
+    // it is narrowed by trpc::Deadline of the calling coroutine,
+    // and an expired call fails with ETIMEDOUT before it is sent
     void setTimeout(std::chrono::milliseconds timeout);
 
+    // in-process only: call() hands the request tree to the server of this thread as is,
+    // without dump and parse (other calls still go in frames)
+    // off by default, then the server gets exactly the frame a remote caller would send
+    void skipSerialization(bool skip = true);
+
     // last errno
     int error();
 
+    // -1 if in-process
     int fd() const;
 
+    // true if the socket (or in-process connection) is open
+    //
+    // a timed out call doesn't break the connection:
+    // its response is read into the buffer later and skipped by id
+    bool available();
+
 // connection
 public:
 
     // true if connected to endpoint
+    // a shared memory endpoint also waits for the ring buffer from server
+    // an in-process endpoint needs no socket, and the socket of init() is closed
     bool connect(Endpoint endpoint);
 
     // void shutdown(int WHERE);
@@ -49,8 +115,32 @@ public:
 
 private:
 
-    std::tuple<bool, ssize_t> bestEffortRead(const void *buf, size_t size, size_t maxRetries = 10);
-    std::tuple<bool, ssize_t> bestEffortWrite(const void *buf, size_t size, size_t maxRetries = 10);
+    // write request, read responses and hand them to `bool onResponse(vsjson::Json &)`
+    // until one is accepted, the others are stale (of timed out calls) and skipped
+    // false if the exchange failed, see error()
+    template <typename Func>
+    bool roundTrip(vsjson::Json &request, Deadline::TimePoint deadline, Func &&onResponse);
+
+    // write request only, with the remaining budget in it (or in each of a batch)
+    bool send(vsjson::Json &request, Deadline::TimePoint deadline);
+
+    // the earlier one of timeout and trpc::Deadline
+    Deadline::TimePoint deadline() const;
+
+    // negotiate() again on a new connection if it was called before
+    // true (names are used if it fails)
+    bool renegotiate();
+
+    // method id if negotiated, or else method name
+    vsjson::Json method(const std::string &function) const;
+
+    bool async() const;
+
+    // call() without serialization, see skipSerialization()
+    bool direct() const;
+
+    // nullopt if failed or dropped by server, see error()
+    std::optional<vsjson::Json> respond(vsjson::Json &request, Deadline::TimePoint deadline);
 
 // class attributes
 public:
@@ -70,7 +160,8 @@ public:
     ~Client();
 
     // two phase construction
-    void init();
+    // connect() reopens the socket if `domain` is not the family of endpoint
+    void init(int domain = AF_INET);
 
     void swap(Client&);
 
@@ -87,22 +178,26 @@ public:
     // 2. any further function call later raise an error and catch errno
     constexpr static int SOCKET_INVALID = -1;
 
-    // 16KiB
-    constexpr static size_t BUF_SIZE_ON_STACK = 1 << 14;
+    // 64MiB, a larger frame breaks the connection
+    constexpr static size_t MAX_FRAME_SIZE = 1 << 26;
 
     constexpr static std::chrono::milliseconds NO_TIMEDOUT
         {std::chrono::hours {1<<9}};
 
 private:
-    // owned socket fd
-    int _socket;
+    // the socket (or stream) and the async calls in flight on it
+    struct Connection;
 
-    // **soft** limit timeout
-    std::chrono::milliseconds _timeout {NO_TIMEDOUT};
+    // co-owned by the reader coroutine, which may outlive this client:
+    // a completion may destroy it, or it is destroyed with calls in flight
+    std::shared_ptr<Connection> _connection;
 
-    // cached system call errno
-    // or timeout in application layer (ETIMEDOUT)
-    int _errno;
+    // server of an in-process connection, see respond()
+    std::shared_ptr<detail::Loopback> _loopback;
+    bool _skipSerialization {};
+
+    // budget of a call, see setTimeout()
+    std::chrono::milliseconds _timeout {NO_TIMEDOUT};
 
     // inspired by GFS
     // detail::Lru<vsjson::Json> _lru;
@@ -110,25 +205,312 @@ private:
     // very simple token generator
     detail::TokenGenerator _tokens;
 
-    detail::Codec _codec;
+    // method name -> method id, filled by negotiate()
+    // ids are of a connection, they are dropped by close() and connect()
+    std::unordered_map<std::string, int64_t> _methodIds;
+
+    // negotiate() was called, it is done again by connect()
+    bool _negotiated {};
+};
+
+struct Client::Connection {
+    // owned socket fd
+    int socket {SOCKET_INVALID};
+
+    // requests and responses go through it instead of the socket if set,
+    // see Endpoint::sharedMemory
+    std::unique_ptr<detail::RingStream> ring;
+
+    // or an in-process connection, see Endpoint::inProcess
+    std::shared_ptr<detail::PipeStream> pipe;
+
+    // cached system call errno
+    // or timeout in application layer (ETIMEDOUT)
+    int error {};
+
+    detail::Codec codec;
+
+    // response json trees are allocated here
+    // and released right before decoding the next one (unless a reader still holds it)
+    std::shared_ptr<vsjson::Arena> arena {std::make_shared<vsjson::Arena>()};
+
+    // responses are read ahead here
+    detail::Buffer buffer;
+
+    struct Pending {
+        Deadline::TimePoint                     deadline;
+        // nullptr response if failed
+        std::function<void(vsjson::Json*)>      complete;
+    };
+
+    // token -> async call
+    std::unordered_map<int64_t, Pending> pending;
+
+    // reader coroutine is running
+    bool reading {};
+
+    Connection() = default;
+    Connection(const Connection&) = delete;
+    ~Connection() { close(); }
+
+    // true if the socket (or stream) is open
+    bool available() const { return socket != SOCKET_INVALID || pipe; }
 
-    // health (or consistency?) check
-    detail::Health _health;
+    // read a whole frame into buffer, the frame length if succeeded
+    // a timed out frame is kept and completed by the next read,
+    // any other failure closes the connection
+    std::optional<size_t> readFrame(Deadline::TimePoint deadline);
+
+    // at least `size` bytes in buffer
+    bool fill(size_t size, Deadline::TimePoint deadline);
+
+    // decode the frame at the front of buffer, then consume it
+    // the response (views into buffer) is valid until the next read
+    std::optional<vsjson::Json> decodeFrame(size_t length);
+
+    // reader coroutine of async calls, it runs until no call is pending
+    void readLoop();
+
+    // complete the pending calls out of deadline as failed
+    // false if none is pending then
+    bool expirePending();
+
+    // complete all the pending calls as failed
+    void failPending();
+
+    // gathered into one write for a socket, `iov` is consumed
+    std::tuple<bool, ssize_t> bestEffortWrite(iovec *iov, int count, Deadline::TimePoint deadline);
+
+    // the same as detail::bestEffortReadSome(), from the socket or a stream
+    ssize_t readSome(void *buf, size_t least, size_t most, Deadline::TimePoint deadline);
+
+    // the peer is told before the socket is closed
+    void close();
+
+    // wake up a reader asleep on it, it reads FIN then,
+    // nothing is closed under the reader
+    void shutdown();
+};
+
+class Client::Batch {
+public:
+    // i-th result is of the i-th call, nullopt if that call failed
+    // or all nullopt if the whole batch failed (see Client::error())
+    using Results = std::vector<std::optional<vsjson::Json>>;
+
+    template <typename ...Args>
+    Batch& call(const std::string &function, Args &&...arguments);
+
+    // no result for it, see Client::notify()
+    template <typename ...Args>
+    Batch& notify(const std::string &function, Args &&...arguments);
+
+    // one frame for all the calls, then the batch is empty again
+    Results send();
+
+    // calls and notifications
+    size_t size() const { return _requests.arraySize(); }
+
+private:
+    friend class Client;
+    explicit Batch(Client &client): _client(&client), _requests(vsjson::Json::array()) {}
+
+private:
+    Client                *_client;
+    vsjson::Json           _requests;
+    std::vector<int64_t>   _tokens;
 };
 
+inline bool Client::async() const {
+    return _connection->reading || !_connection->pending.empty();
+}
+
+inline bool Client::direct() const {
+    return _skipSerialization && _connection->pipe && _connection->pipe->local();
+}
+
 template <typename T, typename ...Args>
 inline std::optional<T> Client::call(const std::string &function, Args &&...arguments) {
+    // the reader owns the socket now
+    if(async()) {
+        return asyncCall<T>(function, std::forward<Args>(arguments)...).get();
+    }
+    auto token = _tokens.acquire();
+    auto request = detail::makeRequest(token, method(function), std::forward<Args>(arguments)...);
+    std::optional<T> result;
+    if(direct()) {
+        if(auto response = respond(request, deadline())) {
+            result = detail::makeResult<T>(*response);
+        }
+        return result;
+    }
+    roundTrip(request, deadline(), [&](vsjson::Json &response) {
+        // a stale batch is an array
+        if(!response.is<vsjson::ObjectImpl>()) {
+            return false;
+        }
+        auto &id = response[detail::protocol::Field::id];
+        if(!id.is<vsjson::IntegerImpl>() || id.to<int64_t>() != token) {
+            return false;
+        }
+        result = detail::makeResult<T>(response);
+        return true;
+    });
+    return result;
+
+    // we will not capture exceptions
+    // because user may explicitly call a function throwing exceptions
+}
+
+template <typename T, typename ...Args>
+inline Future<T> Client::asyncCall(const std::string &function, Args &&...arguments) {
+    Promise<T> promise;
+    auto future = promise.future();
+    auto token = _tokens.acquire();
+    auto request = detail::makeRequest(token, method(function), std::forward<Args>(arguments)...);
+    auto deadline = this->deadline();
+    if(!send(request, deadline)) {
+        promise.set(std::nullopt);
+        return future;
+    }
+    _connection->pending[token] = {deadline, [promise](vsjson::Json *response) mutable {
+        promise.set(response ? detail::makeResult<T>(*response) : std::nullopt);
+    }};
+    if(!_connection->reading) {
+        _connection->reading = true;
+        // it co-owns the connection, see _connection
+        co::open().createCoroutine([connection = _connection] { connection->readLoop(); })->resume();
+    }
+    return future;
+}
+
+template <typename Func>
+inline bool Client::roundTrip(vsjson::Json &request, Deadline::TimePoint deadline, Func &&onResponse) {
 
+    if(async()) {
+        _connection->error = EBUSY;
+        return false;
+    }
+
+    if(!send(request, deadline)) {
+        return false;
+    }
+
+    // if read (response) failed
+    // this connection is still alive
+    while(1) {
+        auto length = _connection->readFrame(deadline);
+        if(!length) {
+            return false;
+        }
+        auto response = _connection->decodeFrame(*length);
+        if(!response) {
+            return false;
+        }
+        if(onResponse(*response)) {
+            return true;
+        }
+    }
+}
+
+inline std::optional<size_t> Client::Connection::readFrame(Deadline::TimePoint deadline) {
     using Header = detail::Codec::Header;
+    if(!fill(sizeof(Header), deadline)) {
+        return std::nullopt;
+    }
+    auto [/*fastVerify*/ _, contentLength] = codec.contentLength(buffer.data(), sizeof(Header));
+    if(contentLength > MAX_FRAME_SIZE) {
+        error = EMSGSIZE;
+        close();
+        return std::nullopt;
+    }
+    if(!fill(sizeof(Header) + contentLength, deadline)) {
+        return std::nullopt;
+    }
+    return sizeof(Header) + contentLength;
+}
+
+inline bool Client::Connection::fill(size_t size, Deadline::TimePoint deadline) {
+    while(buffer.size() < size) {
+        size_t least = size - buffer.size();
+        auto buf = buffer.reserve(least);
+        // read ahead as much as possible
+        ssize_t ret = readSome(buf, least, buffer.writable(), deadline);
+        if(ret > 0) {
+            buffer.commit(ret);
+        }
+        if(ret < static_cast<ssize_t>(least)) {
+            // bytes in buffer are still in order, so a timeout is harmless
+            if(errno == ETIMEDOUT) {
+                error = ETIMEDOUT;
+            } else {
+                // FIN or error
+                error = errno ? errno : ECONNRESET;
+                close();
+            }
+            return false;
+        }
+    }
+    return true;
+}
 
-    if(!_health.check(_socket)) {
+inline std::optional<vsjson::Json> Client::Connection::decodeFrame(size_t length) {
+    // see readLoop()
+    if(arena.use_count() == 1) arena->reset();
+    std::optional<vsjson::Json> response;
+    try {
+        // pipelined frames may follow in the buffer
+        response = codec.decode(buffer.terminate(length), length, arena->resource());
+    } catch(const detail::Codec::InstanceException &e) {
+        error = EPROTO;
+        close();
         return std::nullopt;
     }
+    // no read until the response is handled
+    buffer.consume(length);
+    return response;
+}
 
-    auto token = _tokens.acquire();
-    auto request = detail::makeRequest(token, function, std::forward<Args>(arguments)...);
+template <typename ...Args>
+inline bool Client::notify(const std::string &function, Args &&...arguments) {
+    auto request = detail::makeNotification(method(function), std::forward<Args>(arguments)...);
+    return send(request, deadline());
+}
+
+inline std::optional<vsjson::Json> Client::respond(vsjson::Json &request, Deadline::TimePoint deadline) {
+    if(deadline <= Deadline::Clock::now()) {
+        _connection->error = ETIMEDOUT;
+        return std::nullopt;
+    }
+    _connection->codec.fillDeadlineToRequest(request, deadline);
+    errno = 0;
+    auto response = _loopback->respond(request);
+    // closed, or dropped by the response callback
+    if(!response) _connection->error = errno ? errno : ECONNRESET;
+    return response;
+}
+
+inline bool Client::send(vsjson::Json &request, Deadline::TimePoint deadline) {
+    if(!available()) {
+        _connection->error = ENOTCONN;
+        return false;
+    }
 
-    auto [dump, length, beLength] = _codec.dump(request);
+    // no budget left, don't bother the server
+    if(deadline <= Deadline::Clock::now()) {
+        _connection->error = ETIMEDOUT;
+        return false;
+    }
+
+    if(request.is<vsjson::ArrayImpl>()) {
+        for(size_t i = 0; i < request.arraySize(); ++i) {
+            _connection->codec.fillDeadlineToRequest(request[i], deadline);
+        }
+    } else {
+        _connection->codec.fillDeadlineToRequest(request, deadline);
+    }
+
+    auto [dump, length, beLength] = _connection->codec.dump(request);
 
     // sacrificing availability for consistency
     //
@@ -136,83 +518,250 @@ inline std::optional<T> Client::call(const std::string &function, Args &&...argu
     // client/connection will not maintain consistency
     // close directly
     //
-    // write request header
-    if(auto [success, written] = bestEffortWrite(&beLength, sizeof beLength); !success) {
+    // write request header and content at once
+    iovec frame[] {{&beLength, sizeof beLength}, {dump.data(), length}};
+    if(auto [success, written] = _connection->bestEffortWrite(frame, 2, deadline); !success) {
+        // prefix bytes has written
         if(written > 0) close();
-        return std::nullopt;
+        return false;
     }
+    return true;
+}
 
-    // write request content
-    if(auto [success, _] = bestEffortWrite(dump.c_str(), length); !success) {
-        // prefix bytes has written
-        close();
-        return std::nullopt;
+inline void Client::Connection::readLoop() {
+    while(!pending.empty()) {
+        // wait for the next response until the earliest deadline
+        auto earliest = std::min_element(pending.begin(), pending.end(),
+            [](auto &&lhs, auto &&rhs) { return lhs.second.deadline < rhs.second.deadline; });
+        auto length = readFrame(earliest->second.deadline);
+        if(!length) {
+            // timed out, late responses will be skipped as unknown ids
+            if(available()) {
+                if(expirePending()) continue;
+                return;
+            }
+            break;
+        }
+        auto response = decodeFrame(*length);
+        if(!response) {
+            break;
+        }
+        // unknown id (e.g. a batch array or a stale response) is discarded
+        if(!response->is<vsjson::ObjectImpl>()) continue;
+        auto &id = (*response)[detail::protocol::Field::id];
+        if(!id.is<vsjson::IntegerImpl>()) continue;
+        auto iter = pending.find(id.to<int64_t>());
+        if(iter == pending.end()) continue;
+        auto complete = std::move(iter->second.complete);
+        pending.erase(iter);
+        // the last one may resume a caller that goes on with a plain call() or batch,
+        // so this reader has to be done before that
+        bool last = pending.empty();
+        if(!last) {
+            complete(&*response);
+            continue;
+        }
+        reading = false;
+        // the caller may go on reading before complete() returns,
+        // the arena is kept until the response is destroyed
+        auto arena = this->arena;
+        complete(&*response);
+        response.reset();
+        return;
     }
+    reading = false;
+    failPending();
+}
 
-    // TODO buffer allocate policy: BufferAllocator
-    char buf[BUF_SIZE_ON_STACK];
+inline bool Client::Connection::expirePending() {
+    auto now = Deadline::Clock::now();
+    std::vector<std::function<void(vsjson::Json*)>> expired;
+    for(auto iter = pending.begin(); iter != pending.end();) {
+        if(iter->second.deadline <= now) {
+            expired.emplace_back(std::move(iter->second.complete));
+            iter = pending.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    // see readLoop()
+    bool more = !pending.empty();
+    if(!more) reading = false;
+    for(auto &complete : expired) complete(nullptr);
+    return more;
+}
 
-    // if read (response) failed
-    // this connection is still alive
-    //
-    // read response header
-    if(auto [success, some] = bestEffortRead(buf, sizeof(Header)); !success) {
-        _health.set(std::max<ssize_t>(0, some), detail::Health::HEADER_READ_SOME, 0 /*unused*/);
-        return std::nullopt;
+inline void Client::Connection::failPending() {
+    // nothing of the pending calls is touched after a callback
+    auto failed = std::move(pending);
+    pending.clear();
+    for(auto &[_, call] : failed) {
+        call.complete(nullptr);
     }
+}
 
-    auto [/*fastVerify*/ _, contentLength] = _codec.contentLength(buf, sizeof(Header));
+inline vsjson::Json Client::method(const std::string &function) const {
+    auto methodId = _methodIds.find(function);
+    if(methodId != _methodIds.end()) {
+        return methodId->second;
+    }
+    return function;
+}
 
-    // what happened?
-    // if(!fastVerify) {
-    //     close();
-    //     return std::nullopt;
-    // }
+inline Client::Batch Client::batch() {
+    return Batch(*this);
+}
 
-    // out of stack
-    // resize is easy, but I don't want to do
-    if(sizeof(Header) + contentLength > sizeof buf) {
-        _errno = ENOMEM;
-        close();
-        return std::nullopt;
-    }
+template <typename ...Args>
+inline Client::Batch& Client::Batch::call(const std::string &function, Args &&...arguments) {
+    auto token = _client->_tokens.acquire();
+    _requests.append(detail::makeRequest(token, _client->method(function),
+        std::forward<Args>(arguments)...));
+    _tokens.emplace_back(token);
+    return *this;
+}
 
-    // read response content
-    if(auto [success, some] = bestEffortRead(buf + sizeof(Header), contentLength); !success) {
-        _health.set(std::max<ssize_t>(0, some), detail::Health::CONTENT_READ_SOME, contentLength);
-        return std::nullopt;
-    }
+template <typename ...Args>
+inline Client::Batch& Client::Batch::notify(const std::string &function, Args &&...arguments) {
+    _requests.append(detail::makeNotification(_client->method(function),
+        std::forward<Args>(arguments)...));
+    return *this;
+}
 
-    if(!_codec.verify(buf, sizeof(Header) + contentLength)) {
-        _errno = EINVAL;
-        return std::nullopt;
+inline Client::Batch::Results Client::Batch::send() {
+    Results results(_tokens.size());
+    if(_requests.arraySize() == 0) {
+        return results;
+    }
+    // the call answered by `response`, or _tokens.size() if none
+    auto position = [&](vsjson::Json &response) -> size_t {
+        if(!response.is<vsjson::ObjectImpl>()) return _tokens.size();
+        auto &id = response[detail::protocol::Field::id];
+        if(!id.is<vsjson::IntegerImpl>()) return _tokens.size();
+        return std::find(_tokens.begin(), _tokens.end(), id.to<int64_t>()) - _tokens.begin();
+    };
+    auto onResponse = [&](vsjson::Json &responses) {
+        // a single error object (null id) if the whole batch is rejected
+        if(!responses.is<vsjson::ArrayImpl>()) {
+            return responses.is<vsjson::ObjectImpl>()
+                && responses[detail::protocol::Field::id].is<vsjson::NullImpl>();
+        }
+        auto &array = responses.as<vsjson::ArrayImpl>();
+        // stale batch
+        if(std::none_of(array.begin(), array.end(),
+                [&](vsjson::Json &response) { return position(response) < _tokens.size(); })) {
+            return false;
+        }
+        // responses may be in any order
+        for(auto &response : array) {
+            size_t pos = position(response);
+            if(pos == _tokens.size()) continue;
+            // copied out of arena
+            results[pos] = detail::makeResult<vsjson::Json>(response);
+        }
+        return true;
+    };
+    // server never replies to a batch of notifications
+    auto deadline = _client->deadline();
+    if(_tokens.empty()) {
+        _client->send(_requests, deadline);
+    } else {
+        _client->roundTrip(_requests, deadline, onResponse);
     }
+    _requests = vsjson::Json::array();
+    _tokens.clear();
+    return results;
+}
 
-    auto response = _codec.decode(buf, sizeof(Header) + contentLength);
-    return detail::makeResult<T>(response);
+inline bool Client::negotiate() {
+    // the method table would change under the calls in flight
+    if(async()) {
+        _connection->error = EBUSY;
+        return false;
+    }
+    _negotiated = true;
+    // copied out of arena
+    auto names = call<vsjson::Json>(detail::protocol::Builtin::methods);
+    if(!names || !names->is<vsjson::ArrayImpl>()) return false;
+    _methodIds.clear();
+    for(size_t id = 0; id < names->arraySize(); ++id) {
+        _methodIds[(*names)[id].to<std::string>()] = id;
+    }
+    return true;
+}
 
-    // we will not capture exceptions
-    // because user may explicitly call a function throwing exceptions
+inline void Client::skipSerialization(bool skip) {
+    _skipSerialization = skip;
 }
 
 inline void Client::setTimeout(std::chrono::milliseconds timeout) {
     _timeout = timeout;
 }
 
+inline Deadline::TimePoint Client::deadline() const {
+    auto deadline = Deadline::current();
+    if(_timeout != NO_TIMEDOUT) {
+        deadline = std::min(deadline, Deadline::Clock::now() + _timeout);
+    }
+    return deadline;
+}
+
 inline int Client::error() {
-    int ret = _errno;
-    _errno = 0;
+    int ret = _connection->error;
+    _connection->error = 0;
     return ret;
 }
 
 inline int Client::fd() const {
-    return _socket;
+    return _connection->socket;
+}
+
+inline bool Client::available() {
+    return _connection->socket != SOCKET_INVALID || _connection->pipe;
 }
 
 inline bool Client::connect(Endpoint endpoint) {
-    int ret = co::connect(_socket, (const sockaddr*)&endpoint, sizeof endpoint);
-    if(ret) _errno = errno;
-    return !ret;
+    // another server (or a restarted one) may number its methods differently
+    _methodIds.clear();
+    if(endpoint.inProcess) {
+        close();
+        _loopback = detail::Loopback::find(endpoint.name());
+        if(_loopback) _connection->pipe = _loopback->connect();
+        if(!_connection->pipe) {
+            _connection->error = errno;
+            _loopback.reset();
+            return false;
+        }
+        return renegotiate();
+    }
+    // init() makes an AF_INET socket, reopen it for another family
+    int domain;
+    socklen_t len = sizeof domain;
+    if(!::getsockopt(_connection->socket, SOL_SOCKET, SO_DOMAIN, &domain, &len) && domain != endpoint.family()) {
+        close();
+        init(endpoint.family());
+        if(_connection->socket < 0) return false;
+    }
+    int ret = co::connect(_connection->socket, endpoint.data(), endpoint.size());
+    if(ret) {
+        _connection->error = errno;
+        return false;
+    }
+    if(endpoint.sharedMemory) {
+        _connection->ring = detail::RingStream::accept(_connection->socket, deadline());
+        if(!_connection->ring) {
+            _connection->error = errno;
+            close();
+            return false;
+        }
+    }
+    return renegotiate();
+}
+
+inline bool Client::renegotiate() {
+    // calls still work by name if it fails
+    if(_negotiated) negotiate();
+    return true;
 }
 
 inline Client::Client()
@@ -221,8 +770,7 @@ inline Client::Client()
     //
     // if you need a socket in ready
     // use Client::make()
-    : _socket(SOCKET_INVALID),
-      _errno(0)
+    : _connection(std::make_shared<Connection>())
 {}
 
 inline std::optional<Client> Client::make() {
@@ -238,22 +786,25 @@ inline std::optional<Client> Client::make(Endpoint endpoint) {
     if(!co::test()) /*[[unlikely]]*/ {
         return std::nullopt;
     }
-    auto opt = make();
-    if(!opt || !opt->connect(endpoint)) /*[[unlikely]]*/ {
+    Client client;
+    if(!endpoint.inProcess) client.init(endpoint.family());
+    if(client.error() || !client.connect(endpoint)) /*[[unlikely]]*/ {
         return std::nullopt;
     }
-    return opt;
+    return client;
 }
 
 
 inline Client::Client(Client &&rhs)
-    : _socket(rhs._socket),
+    : _connection(std::exchange(rhs._connection, std::make_shared<Connection>())),
+      _loopback(std::move(rhs._loopback)),
+      _skipSerialization(rhs._skipSerialization),
       _timeout(rhs._timeout),
-      _errno(rhs._errno),
-      _health(rhs._health)
-{
-    rhs._socket = SOCKET_INVALID;
-}
+      // ids of the calls in flight are not handed out again
+      _tokens(rhs._tokens),
+      _methodIds(std::move(rhs._methodIds)),
+      _negotiated(rhs._negotiated)
+{}
 
 inline Client& Client::operator=(Client that) {
     that.swap(*this);
@@ -264,50 +815,90 @@ inline Client::~Client() {
     this->close();
 }
 
-inline void Client::init() {
-    _socket = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
-    if(_socket < 0) _errno = errno;
+inline void Client::init(int domain) {
+    _connection->socket = ::socket(domain, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(_connection->socket < 0) {
+        _connection->error = errno;
+        return;
+    }
+    // a request is written at once (see send()), don't hold it for ACK
+    if(!detail::noDelay(_connection->socket, domain)) _connection->error = errno;
 }
 
 inline void Client::swap(Client &that) {
     using std::swap;
-    swap(this->_socket, that._socket);
+    swap(this->_connection, that._connection);
+    swap(this->_loopback, that._loopback);
+    swap(this->_skipSerialization, that._skipSerialization);
     swap(this->_timeout, that._timeout);
-    swap(this->_errno, that._errno);
     swap(this->_tokens, that._tokens);
-    swap(this->_codec, that._codec);
-    swap(this->_health, that._health);
+    swap(this->_methodIds, that._methodIds);
+    swap(this->_negotiated, that._negotiated);
 }
 
 inline void Client::close() {
-    if(_socket != SOCKET_INVALID) {
-        ::close(_socket);
-        _socket = SOCKET_INVALID;
+    if(_connection->reading) {
+        // the reader may be asleep on it, so it is only shut down here,
+        // and closed by the reader (or whichever of them is the last owner)
+        auto connection = std::exchange(_connection, std::make_shared<Connection>());
+        _connection->error = connection->error;
+        connection->shutdown();
+        connection->failPending();
+    } else {
+        _connection->close();
     }
+    _loopback.reset();
+    _methodIds.clear();
 }
 
-inline std::tuple<bool, ssize_t> Client::bestEffortRead(const void *buf, size_t size, size_t maxRetries) {
-    ssize_t ret = detail::bestEffortRead(_socket, buf, size, _timeout, maxRetries);
-    if(ret == size) {
-        return {true, size};
+inline void Client::Connection::close() {
+    // it tells the peer, before the socket
+    ring.reset();
+    if(pipe) {
+        pipe->close();
+        pipe.reset();
     }
-    if(!(_errno = errno)) {
-        // if read m bytes but n > m (active but too slow)
-        // it is also ETIMEDOUT
-        _errno = ETIMEDOUT;
+    if(socket != SOCKET_INVALID) {
+        ::close(socket);
+        socket = SOCKET_INVALID;
     }
-    return {false, ret};
+    buffer.clear();
 }
 
-inline std::tuple<bool, ssize_t> Client::bestEffortWrite(const void *buf, size_t size, size_t maxRetries) {
-    ssize_t ret = detail::bestEffortWrite(_socket, buf, size, _timeout, maxRetries);
-    if(ret == size) {
-        return {true, size};
+inline void Client::Connection::shutdown() {
+    // a ring is waited on with its socket
+    if(socket != SOCKET_INVALID) ::shutdown(socket, SHUT_RDWR);
+    if(pipe) pipe->close();
+}
+
+inline std::tuple<bool, ssize_t> Client::Connection::bestEffortWrite(iovec *iov, int count, Deadline::TimePoint deadline) {
+    size_t size = 0;
+    for(int i = 0; i < count; ++i) size += iov[i].iov_len;
+    ssize_t ret = 0;
+    if(ring || pipe) {
+        // memory copies, nothing to gather
+        for(int i = 0; i < count; ++i) {
+            ssize_t n = ring ? ring->write(iov[i].iov_base, iov[i].iov_len, deadline)
+                : pipe->write(iov[i].iov_base, iov[i].iov_len, deadline);
+            if(n > 0) ret += n;
+            if(n != static_cast<ssize_t>(iov[i].iov_len)) break;
+        }
+    } else {
+        ret = detail::bestEffortWritev(socket, iov, count, deadline);
+    }
+    if(ret == static_cast<ssize_t>(size)) {
+        return {true, ret};
     }
-    if(!(_errno = errno)) {
-        _errno = ETIMEDOUT;
+    if(!(error = errno)) {
+        error = ETIMEDOUT;
     }
     return {false, ret};
 }
 
+inline ssize_t Client::Connection::readSome(void *buf, size_t least, size_t most, Deadline::TimePoint deadline) {
+    if(ring) return ring->read(buf, least, most, deadline);
+    if(pipe) return pipe->read(buf, least, most, deadline);
+    return detail::bestEffortReadSome(socket, buf, least, most, deadline);
+}
+
 } // trcp
@@ -0,0 +1,84 @@
+#pragma once
+#include <chrono>
+#include <optional>
+#include <unordered_map>
+#include "co.hpp"
+namespace trpc {
+
+// coroutine-local deadline of RPC calls
+//
+// a Deadline object narrows the deadline of current coroutine until it is destroyed,
+// every Client call made in this scope is bounded by it,
+// and the remaining budget is carried in the request envelope
+//
+//     {
+//         trpc::Deadline deadline {std::chrono::milliseconds {50}};
+//         auto a = client.call<int>("a");
+//         auto b = client.call<int>("b"); // shares the rest of 50ms
+//     }
+//
+// a server runs each handler under the deadline of its request,
+// so nested calls made from the handler inherit the remaining budget
+class Deadline {
+public:
+    using Clock = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+
+    // no deadline
+    constexpr static TimePoint NEVER = TimePoint::max();
+
+public:
+    // deadline of current coroutine, NEVER if not set
+    static TimePoint current();
+
+    // nested scope can only make it earlier
+    explicit Deadline(TimePoint deadline);
+    explicit Deadline(std::chrono::milliseconds budget);
+
+    Deadline(const Deadline&) = delete;
+    Deadline& operator=(const Deadline&) = delete;
+
+    ~Deadline();
+
+private:
+    // keyed by coroutine, one table per thread (co::Environment)
+    static std::unordered_map<const co::Coroutine*, TimePoint>& table();
+
+private:
+    const co::Coroutine *_owner;
+    TimePoint            _previous;
+};
+
+inline Deadline::TimePoint Deadline::current() {
+    auto &deadlines = table();
+    // fast path: no deadline at all
+    if(deadlines.empty()) return NEVER;
+    auto iter = deadlines.find(&co::Coroutine::current());
+    return iter != deadlines.end() ? iter->second : NEVER;
+}
+
+inline Deadline::Deadline(TimePoint deadline)
+    : _owner(&co::Coroutine::current()),
+      _previous(current())
+{
+    table()[_owner] = std::min(_previous, deadline);
+}
+
+inline Deadline::Deadline(std::chrono::milliseconds budget)
+    : Deadline(Clock::now() + budget)
+{}
+
+inline Deadline::~Deadline() {
+    if(_previous == NEVER) {
+        table().erase(_owner);
+    } else {
+        table()[_owner] = _previous;
+    }
+}
+
+inline std::unordered_map<const co::Coroutine*, Deadline::TimePoint>& Deadline::table() {
+    static thread_local std::unordered_map<const co::Coroutine*, TimePoint> deadlines;
+    return deadlines;
+}
+
+} // trpc
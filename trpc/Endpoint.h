@@ -2,37 +2,214 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <charconv>
+#include <cstddef>
 #include <cstring>
+#include <optional>
 #include <string>
+#include <string_view>
 namespace trpc {
 
-// a simple wrapper for sockaddr_in with compatibility of POSIX interface
-// it is guaranteed that Endpoint has the same memory layout as `sockaddr_in`
+// a socket address with compatibility of POSIX interface, see data() and size()
+//
+// - IPv4 or IPv6: ip and port (AF_INET, AF_INET6)
+// - unix domain stream socket (AF_UNIX): a filesystem path,
+//   or a name in the abstract namespace (Linux), written as "@name"
+// - shared memory: a unix domain socket to set up a ring buffer, see detail::RingStream
+// - in-process: a Server of this process by name, no socket at all (AF_UNSPEC)
 struct Endpoint final {
     Endpoint() = default;
+    // IPv4 or IPv6 literal, no name lookup
+    // a bad ip makes an AF_UNSPEC endpoint (which fails to bind or connect),
+    // see parse() to check it
     Endpoint(const std::string &ip, uint16_t port);
     Endpoint(const char *ip, uint16_t port);
+    // IPv4 in host byte order
     Endpoint(uint32_t ip, uint16_t port);
-    // TODO EndPoint("tcp://....")
 
-    sockaddr_in addr;
+    // "@name" is in the abstract namespace
+    // nullopt if it is empty or too long (sizeof sockaddr_un::sun_path)
+    static std::optional<Endpoint> unixSocket(std::string_view path);
+
+    // - "ip:port", "[ipv6]:port", optionally prefixed by "tcp://"
+    // - "unix:///path/to/socket", "unix://relative/path" or "unix://@name",
+    //   or "unix:path" and "unix:@name" (as written by toString())
+    // - "shm://" or "shm:" is followed by a unix domain socket like "unix://"
+    // - "inproc://name" or "inproc:name" is a Server of this process
+    // nullopt if malformed, nothing is allocated
+    static std::optional<Endpoint> parse(std::string_view uri);
+
+    // AF_INET, AF_INET6, AF_UNIX, or AF_UNSPEC (in-process)
+    int family() const { return storage.ss_family; }
+
+    // the name of an in-process endpoint, or the path of a unix domain socket
+    std::string_view name() const;
+
+    const sockaddr* data() const { return reinterpret_cast<const sockaddr*>(&storage); }
+    sockaddr* data() { return reinterpret_cast<sockaddr*>(&storage); }
+
+    // length of the address, it is set by accept() or getpeername() for a peer
+    socklen_t size() const { return length; }
+
+    // "ip:port", "[ipv6]:port", "unix:/path", "unix:@name", or "unix:" if unnamed (a connecting peer)
+    // "shm:/path" or "shm:@name" for shared memory, "inproc:name" for in-process
+    std::string toString() const;
+
+    // the largest address, for accept() or getpeername()
+    constexpr static socklen_t CAPACITY = sizeof(sockaddr_storage);
+
+    union {
+        sockaddr_storage storage;
+        sockaddr_in      addr;
+        sockaddr_in6     addr6;
+        sockaddr_un      local;
+    };
+    socklen_t length {CAPACITY};
+    // connections are set up over `local`, and then talk in shared memory
+    bool sharedMemory {};
+    // the name is in `local`, see detail::Loopback
+    bool inProcess {};
+
+private:
+    // "ip" or "ipv6" (without brackets), false if malformed
+    bool assign(std::string_view ip, uint16_t port);
 };
 
 inline Endpoint::Endpoint(const std::string &ip, uint16_t port)
     : Endpoint(ip.c_str(), port) {}
 
 inline Endpoint::Endpoint(const char *ip, uint16_t port) {
-    ::memset(&addr, 0, sizeof addr);
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = ::inet_addr(ip);
-    addr.sin_port = ::htons(port);
+    if(!assign(ip, port)) {
+        ::memset(&storage, 0, sizeof storage);
+        storage.ss_family = AF_UNSPEC;
+        length = sizeof(sa_family_t);
+    }
 }
 
 inline Endpoint::Endpoint(uint32_t ip, uint16_t port) {
-    ::memset(&addr, 0, sizeof addr);
+    ::memset(&storage, 0, sizeof storage);
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = ::htonl(ip);
     addr.sin_port = ::htons(port);
+    length = sizeof addr;
+}
+
+inline bool Endpoint::assign(std::string_view ip, uint16_t port) {
+    // for inet_pton
+    char text[INET6_ADDRSTRLEN] {};
+    if(ip.empty() || ip.size() >= sizeof text) return false;
+    ip.copy(text, ip.size());
+    ::memset(&storage, 0, sizeof storage);
+    if(ip.find(':') == std::string_view::npos) {
+        if(::inet_pton(AF_INET, text, &addr.sin_addr) != 1) return false;
+        addr.sin_family = AF_INET;
+        addr.sin_port = ::htons(port);
+        length = sizeof addr;
+        return true;
+    }
+    if(::inet_pton(AF_INET6, text, &addr6.sin6_addr) != 1) return false;
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_port = ::htons(port);
+    length = sizeof addr6;
+    return true;
+}
+
+inline std::optional<Endpoint> Endpoint::unixSocket(std::string_view path) {
+    // a path is terminated by '\0', an abstract name begins with it
+    if(path.empty() || path.size() >= sizeof(sockaddr_un::sun_path)) {
+        return std::nullopt;
+    }
+    Endpoint endpoint;
+    ::memset(&endpoint.storage, 0, sizeof endpoint.storage);
+    endpoint.local.sun_family = AF_UNIX;
+    ::memcpy(endpoint.local.sun_path, path.data(), path.size());
+    bool abstract = path[0] == '@';
+    if(abstract) endpoint.local.sun_path[0] = '\0';
+    endpoint.length = offsetof(sockaddr_un, sun_path) + path.size() + !abstract;
+    return endpoint;
+}
+
+inline std::optional<Endpoint> Endpoint::parse(std::string_view uri) {
+    // consume "scheme://" or "scheme:"
+    auto scheme = [&uri](std::string_view name) {
+        if(uri.substr(0, name.size()) != name || uri.substr(name.size(), 1) != ":") return false;
+        uri.remove_prefix(name.size() + 1);
+        if(uri.substr(0, 2) == "//") uri.remove_prefix(2);
+        return true;
+    };
+    // `unix` may be a predefined macro (GNU dialects)
+    if(scheme("unix")) {
+        return unixSocket(uri);
+    }
+    if(scheme("shm")) {
+        auto endpoint = unixSocket(uri);
+        if(endpoint) endpoint->sharedMemory = true;
+        return endpoint;
+    }
+    if(scheme("inproc")) {
+        // stored like an abstract socket name, but never bound
+        if(uri.empty() || uri.size() + 1 >= sizeof(sockaddr_un::sun_path)) return std::nullopt;
+        Endpoint endpoint;
+        ::memset(&endpoint.storage, 0, sizeof endpoint.storage);
+        endpoint.local.sun_family = AF_UNSPEC;
+        ::memcpy(endpoint.local.sun_path + 1, uri.data(), uri.size());
+        endpoint.length = offsetof(sockaddr_un, sun_path) + 1 + uri.size();
+        endpoint.inProcess = true;
+        return endpoint;
+    }
+    // optional
+    scheme("tcp");
+    auto colon = uri.rfind(':');
+    if(colon == std::string_view::npos) return std::nullopt;
+    auto ip = uri.substr(0, colon);
+    auto port = uri.substr(colon + 1);
+    if(ip.size() >= 2 && ip.front() == '[' && ip.back() == ']') {
+        ip = ip.substr(1, ip.size() - 2);
+        if(ip.find(':') == std::string_view::npos) return std::nullopt;
+    } else if(ip.find(':') != std::string_view::npos) {
+        // "::1:80" is ambiguous
+        return std::nullopt;
+    }
+    uint16_t value;
+    auto [end, error] = std::from_chars(port.data(), port.data() + port.size(), value);
+    if(port.empty() || error != std::errc() || end != port.data() + port.size()) {
+        return std::nullopt;
+    }
+    Endpoint endpoint;
+    if(!endpoint.assign(ip, value)) return std::nullopt;
+    return endpoint;
+}
+
+inline std::string_view Endpoint::name() const {
+    if(length <= offsetof(sockaddr_un, sun_path)) return {};
+    size_t size = length - offsetof(sockaddr_un, sun_path);
+    // abstract
+    if(local.sun_path[0] == '\0') return {local.sun_path + 1, size - 1};
+    return {local.sun_path, ::strnlen(local.sun_path, size)};
+}
+
+inline std::string Endpoint::toString() const {
+    if(inProcess) {
+        return "inproc:" + std::string(name());
+    }
+    if(family() == AF_UNIX) {
+        std::string scheme = sharedMemory ? "shm:" : "unix:";
+        if(length <= offsetof(sockaddr_un, sun_path)) return scheme;
+        size_t size = length - offsetof(sockaddr_un, sun_path);
+        if(local.sun_path[0] == '\0') {
+            return scheme + "@" + std::string(local.sun_path + 1, size - 1);
+        }
+        return scheme + std::string(local.sun_path, ::strnlen(local.sun_path, size));
+    }
+    char ip[INET6_ADDRSTRLEN] {};
+    if(family() == AF_INET6) {
+        ::inet_ntop(AF_INET6, &addr6.sin6_addr, ip, sizeof ip);
+        return "[" + std::string(ip) + "]:" + std::to_string(::ntohs(addr6.sin6_port));
+    }
+    ::inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof ip);
+    return std::string(ip) + ":" + std::to_string(::ntohs(addr.sin_port));
 }
 
 } // trcp
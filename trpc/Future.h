@@ -0,0 +1,165 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "co.hpp"
+namespace trpc {
+
+// lightweight single-thread future for Client::asyncCall()
+//
+// result is std::optional<T>, nullopt if failed (the same as Client::call())
+// it is completed in the coroutine that reads the response,
+// callbacks run there and waiting coroutines are resumed from there
+template <typename T>
+class Future;
+
+template <typename T>
+class Promise;
+
+namespace detail {
+
+template <typename T>
+struct FutureState {
+    using Callback = std::function<void(const std::optional<T>&)>;
+
+    std::optional<T>                            value;
+    bool                                        ready {};
+    std::vector<Callback>                       callbacks;
+    std::vector<std::shared_ptr<co::Coroutine>> waiters;
+};
+
+} // detail
+
+template <typename T>
+class Future {
+public:
+    bool ready() const { return _state->ready; }
+
+    // wait until completed, must be in coroutine unless ready()
+    // nullopt if failed (or not in coroutine)
+    std::optional<T> get();
+
+    // require: void(const std::optional<T> &)
+    // run at once if ready
+    // Note: it runs in the reader coroutine, never wait (get()) in it
+    template <typename Func>
+    void then(Func &&callback);
+
+private:
+    friend class Promise<T>;
+    explicit Future(std::shared_ptr<detail::FutureState<T>> state): _state(std::move(state)) {}
+
+private:
+    std::shared_ptr<detail::FutureState<T>> _state;
+};
+
+template <typename T>
+class Promise {
+public:
+    Promise(): _state(std::make_shared<detail::FutureState<T>>()) {}
+
+    Future<T> future() const { return Future<T>(_state); }
+
+    // only the first one takes effect
+    void set(std::optional<T> value);
+
+    bool ready() const { return _state->ready; }
+
+private:
+    std::shared_ptr<detail::FutureState<T>> _state;
+};
+
+// completed when all of the futures are completed, in the same order
+template <typename T>
+Future<std::vector<std::optional<T>>> whenAll(const std::vector<Future<T>> &futures);
+
+// completed with the index of the first successful future,
+// or nullopt when all of them failed
+template <typename T>
+Future<size_t> whenAny(const std::vector<Future<T>> &futures);
+
+template <typename T>
+inline std::optional<T> Future<T>::get() {
+    if(!_state->ready) {
+        if(!co::test()) return std::nullopt;
+        _state->waiters.emplace_back(co::Coroutine::current().shared_from_this());
+        // resumed by Promise::set()
+        while(!_state->ready) co::this_coroutine::yield();
+    }
+    return _state->value;
+}
+
+template <typename T>
+template <typename Func>
+inline void Future<T>::then(Func &&callback) {
+    if(_state->ready) {
+        callback(_state->value);
+        return;
+    }
+    _state->callbacks.emplace_back(std::forward<Func>(callback));
+}
+
+template <typename T>
+inline void Promise<T>::set(std::optional<T> value) {
+    if(_state->ready) return;
+    // keep alive, callbacks may drop the last future
+    auto state = _state;
+    state->value = std::move(value);
+    state->ready = true;
+    auto callbacks = std::move(state->callbacks);
+    auto waiters = std::move(state->waiters);
+    for(auto &callback : callbacks) callback(state->value);
+    for(auto &waiter : waiters) waiter->resume();
+}
+
+template <typename T>
+inline Future<std::vector<std::optional<T>>> whenAll(const std::vector<Future<T>> &futures) {
+    using Results = std::vector<std::optional<T>>;
+    Promise<Results> promise;
+    if(futures.empty()) {
+        promise.set(Results{});
+        return promise.future();
+    }
+    struct Context {
+        Results results;
+        size_t  remain;
+    };
+    auto context = std::make_shared<Context>(Context{Results(futures.size()), futures.size()});
+    for(size_t i = 0; i < futures.size(); ++i) {
+        auto future = futures[i];
+        future.then([=](const std::optional<T> &result) mutable {
+            context->results[i] = result;
+            if(--context->remain == 0) {
+                promise.set(std::move(context->results));
+            }
+        });
+    }
+    return promise.future();
+}
+
+template <typename T>
+inline Future<size_t> whenAny(const std::vector<Future<T>> &futures) {
+    Promise<size_t> promise;
+    if(futures.empty()) {
+        promise.set(std::nullopt);
+        return promise.future();
+    }
+    auto failures = std::make_shared<size_t>(0);
+    size_t total = futures.size();
+    for(size_t i = 0; i < futures.size(); ++i) {
+        auto future = futures[i];
+        future.then([=](const std::optional<T> &result) mutable {
+            if(result) {
+                promise.set(i);
+            } else if(++*failures == total) {
+                promise.set(std::nullopt);
+            }
+        });
+    }
+    return promise.future();
+}
+
+} // trpc
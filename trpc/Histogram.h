@@ -0,0 +1,110 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+namespace trpc {
+namespace detail {
+
+// written by one thread, read by any thread
+// relaxed load and store, no read-modify-write (lock prefix) on the hot path
+class Counter {
+public:
+    Counter() = default;
+    Counter(const Counter &rhs): _value(rhs.get()) {}
+    Counter& operator=(const Counter &rhs) { set(rhs.get()); return *this; }
+
+    void add(uint64_t n = 1) { set(get() + n); }
+    void set(uint64_t n) { _value.store(n, std::memory_order_relaxed); }
+    uint64_t get() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> _value {};
+};
+
+} // detail
+
+// HDR-style log-linear histogram of nanoseconds
+//
+// each power of 2 range is split into 16 buckets, so the relative error is within 1/16
+// values are recorded by one thread, a copy is a snapshot that can be read or merged
+class Histogram {
+public:
+    void record(uint64_t nanoseconds);
+    void record(std::chrono::nanoseconds duration) { record(std::max<int64_t>(0, duration.count())); }
+
+    // add up another snapshot
+    void merge(const Histogram &that);
+
+    uint64_t count() const { return _count.get(); }
+    uint64_t max() const { return _max.get(); }
+    double mean() const { return count() ? double(_sum.get()) / count() : 0; }
+
+    // p in [0, 1], the highest value of the bucket
+    uint64_t percentile(double p) const;
+
+private:
+    constexpr static size_t SUB_BITS = 4;
+    constexpr static size_t SUB_BUCKETS = 1 << SUB_BITS;
+    // up to 2^44ns (about 4.9 hours), larger ones are clamped
+    constexpr static size_t MAX_SHIFT = 40;
+    constexpr static size_t BUCKETS = (MAX_SHIFT + 2) * SUB_BUCKETS;
+
+    static size_t index(uint64_t value);
+    static uint64_t highest(size_t index);
+
+private:
+    std::array<detail::Counter, BUCKETS> _buckets;
+    detail::Counter                      _count;
+    detail::Counter                      _sum;
+    detail::Counter                      _max;
+};
+
+inline size_t Histogram::index(uint64_t value) {
+    if(value < 2 * SUB_BUCKETS) return value;
+    size_t msb = 63 - __builtin_clzll(value);
+    size_t shift = msb - SUB_BITS;
+    if(shift > MAX_SHIFT) return BUCKETS - 1;
+    // (value >> shift) is in [16, 32)
+    return shift * SUB_BUCKETS + (value >> shift);
+}
+
+inline uint64_t Histogram::highest(size_t index) {
+    if(index < 2 * SUB_BUCKETS) return index;
+    size_t shift = index / SUB_BUCKETS - 1;
+    uint64_t mantissa = index - shift * SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+inline void Histogram::record(uint64_t nanoseconds) {
+    _buckets[index(nanoseconds)].add();
+    _count.add();
+    _sum.add(nanoseconds);
+    if(nanoseconds > _max.get()) _max.set(nanoseconds);
+}
+
+inline void Histogram::merge(const Histogram &that) {
+    for(size_t i = 0; i < BUCKETS; ++i) {
+        _buckets[i].add(that._buckets[i].get());
+    }
+    _count.add(that.count());
+    _sum.add(that._sum.get());
+    _max.set(std::max(max(), that.max()));
+}
+
+inline uint64_t Histogram::percentile(double p) const {
+    uint64_t total = count();
+    if(total == 0) return 0;
+    // 1-based rank
+    uint64_t rank = std::max<uint64_t>(1, std::clamp(p, 0.0, 1.0) * total + 0.5);
+    uint64_t seen = 0;
+    for(size_t i = 0; i < BUCKETS; ++i) {
+        seen += _buckets[i].get();
+        if(seen >= rank) return std::min(highest(i), max());
+    }
+    return max();
+}
+
+} // trpc
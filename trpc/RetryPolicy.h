@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <chrono>
+#include <string>
+#include <unordered_set>
+namespace trpc {
+
+// retry and hedging policy of trpc::Channel
+//
+// only the methods listed in `idempotent` are retried or hedged,
+// because either may execute a call more than once
+struct RetryPolicy {
+    std::unordered_set<std::string> idempotent;
+
+    // attempts of a call, including the first one
+    // a failed attempt is retried on another endpoint (if any)
+    size_t                    maxAttempts {1};
+
+    // hedging: if the call is slower than `percentile` of the recent latency of its method
+    // (but not less than `minDelay`), send a backup request to another endpoint,
+    // the first success wins, the other one is dropped
+    bool                      hedging {false};
+    double                    percentile {0.95};
+    std::chrono::milliseconds minDelay {1};
+
+    // retry budget: retries and backups are at most `budgetRatio` of calls,
+    // plus `budgetReserve` per second for low traffic
+    double                    budgetRatio {0.1};
+    size_t                    budgetReserve {10};
+};
+
+} // trpc
@@ -2,18 +2,30 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <algorithm>
 #include <optional>
 #include <chrono>
 #include <cstddef>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <memory>
 #include "co.hpp"
+#include "Deadline.h"
 #include "Endpoint.h"
-#include "detail/CallProxy.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "detail/Admission.h"
+#include "detail/MethodTable.h"
+#include "detail/Params.h"
 #include "detail/Codec.h"
+#include "detail/Metrics.h"
+#include "detail/Scratch.h"
+#include "detail/Outbound.h"
 #include "detail/resolve.h"
 #include "detail/bestEffort.h"
+#include "detail/RingStream.h"
+#include "detail/Loopback.h"
 namespace trpc {
 
 class Server {
@@ -21,6 +33,9 @@ public:
 
     using ProtocolType = detail::Codec::ProtocolType;
 
+    // see detail::Admission
+    using Limits = detail::Admission::Limits;
+
 public:
 
     // resume in coroutine
@@ -31,13 +46,23 @@ public:
     template <typename F>
     void bind(const std::string &method, const F &func);
 
+    // build a perfect hash table for the bound methods
+    // start() freezes it anyway, bind() after that unfreezes it
+    void freeze();
+
     int fd() const { return _fd; }
 
     int error();
 
+    // budget of each read or write
+    // (handlers are bounded by the deadline of request instead)
     void setTimeout(std::chrono::milliseconds timeout);
     void setPending(std::chrono::milliseconds timeout);
 
+    // admission control, unlimited by default
+    // a request over the limits gets a "Server overloaded" error (-32000)
+    void setLimits(Limits limits);
+
     // require: bool(ProtocolType &)
     // TODO: abstract context, not ProtocolType
     template <typename Func>
@@ -50,6 +75,9 @@ public:
 public:
 
     // see Client::Client()
+    // a unix domain socket file left by a dead server is replaced,
+    // and removed again by close()
+    // an in-process endpoint takes its name in init(), and close() ends start()
     explicit Server(Endpoint);
 
     Server(const Server&) = delete;
@@ -69,14 +97,85 @@ public:
 
 private:
 
-    ProtocolType netCall(const std::string &method, ProtocolType args);
-
-    void onAccept(int peerFd, Endpoint peerEndpoint);
-
-    bool bestEffortRead(int peer, const void *buf, size_t size, size_t maxRetries = 6);
-    bool bestEffortWrite(int peer, const void *buf, size_t size, size_t maxRetries = 6);
+    // method: name or method id
+    // `sample` is attributed to the method once it is found
+    ProtocolType netCall(const ProtocolType &method, detail::Params &params, detail::Sample &sample);
+
+    // methods reserved by server, see detail::protocol::Builtin
+    ProtocolType builtinCall(std::string_view method, detail::Params &params, detail::Sample &sample);
+
+    // fill result or error to response
+    // return the error code, 0 if succeeded
+    template <typename Call>
+    int invoke(ProtocolType &response, Call &&call);
+
+    // notification: nothing to reply, errors are dropped as well (but still counted)
+    template <typename Call>
+    int invokeQuietly(Call &&call);
+
+    // expired request is rejected before it runs,
+    // then it waits for admission (see detail::Admission),
+    // and runs under trpc::Deadline, nested calls inherit the remaining budget
+    template <typename Call>
+    ProtocolType execute(Deadline::TimePoint deadline, detail::Sample &sample, Call &&call);
+
+    // end the sample and record it to its method, see trpc::Stats
+    void record(detail::Sample &sample);
+
+    // in-process request without serialization, see Client::skipSerialization()
+    std::optional<ProtocolType> respond(ProtocolType &request);
+
+    // start() of an in-process endpoint
+    void serveInProcess();
+
+    // serve a connection until it is closed or broken
+    // Stream: detail::SocketStream, or detail::RingStream (shared memory endpoint)
+    template <typename Stream>
+    void onAccept(Stream &stream, detail::ConnectionMetrics &connection);
+
+    // lazy mode: only the top level of request is indexed,
+    // a bad method or arity is rejected before params are parsed,
+    // and each param is parsed when converted to its argument type
+    //
+    // null if nothing to reply (notifications)
+    //
+    // `arrival` is the time the frame is read, the start of request budget
+    //
+    // `sample` is the metrics of this request (or batch frame),
+    // each request in a batch is recorded on its own
+    //
+    // `text` is the whole frame (nothing but whitespace after the request),
+    // unless it is `batched` (followed by the rest of the batch)
+    ProtocolType handle(const char *text, Deadline::TimePoint arrival, vsjson::Resource *resource,
+                        detail::Sample &sample, bool batched = false);
+    ProtocolType handleBatch(const char *text, Deadline::TimePoint arrival, vsjson::Resource *resource,
+                             detail::Sample &sample);
+
+    // eager mode (with request callback), or an in-process request tree
+    // nullopt if dropped by callback or a notification
+    std::optional<ProtocolType> handle(ProtocolType &request, Deadline::TimePoint arrival,
+                                       detail::Sample &sample);
+    ProtocolType handleBatch(ProtocolType &requests, Deadline::TimePoint arrival, detail::Sample &sample);
+
+    // a unix domain socket bound to a filesystem path (not abstract)
+    static bool isSocketFile(const Endpoint &endpoint);
+
+    template <typename Stream>
+    bool bestEffortRead(Stream &peer, void *buf, size_t size);
+    template <typename Stream>
+    bool bestEffortWrite(Stream &peer, const void *buf, size_t size);
+    // write all the queued responses at once, the queue is empty then
+    template <typename Stream>
+    bool flush(Stream &peer, detail::Outbound &outbound);
+    // flushes the corked responses once they are older than Outbound::MAX_DELAY,
+    // while the connection is busy in a read or a (yielding) handler
+    // it yields when nothing is corked, and returns once `cork` is closed
+    template <typename Stream>
+    std::shared_ptr<co::Coroutine> corkTimer(Stream &peer, detail::Outbound &outbound,
+                                             std::shared_ptr<detail::Cork> cork);
     // used in first byte
-    bool bestEffortPending(int peer);
+    template <typename Stream>
+    bool bestEffortPending(Stream &peer);
 
 public:
 
@@ -96,23 +195,28 @@ public:
     constexpr static std::chrono::milliseconds MIN_LONG_CONNECTION_PENDING
         {std::chrono::hours {1}};
 
+    // poll interval of a flush behind the one of the cork timer
+    constexpr static std::chrono::microseconds MAX_FLUSH_WAIT {1000};
+
 private:
 
     // listen fd
     // owned by server
     int _fd;
 
-    // server {ip : port}
+    // instead of _fd for an in-process endpoint
+    std::shared_ptr<detail::Loopback> _loopback;
+
+    // server {ip : port} or unix domain socket
     Endpoint _endpoint;
 
     // bound function
-    using Proxy = std::function<ProtocolType(ProtocolType)>;
-    std::unordered_map<std::string, Proxy> _table;
+    detail::MethodTable _table;
 
     // system call errno or application layer error
     int _errno;
 
-    // **soft** limit timeout
+    // budget of each read or write
     std::chrono::milliseconds _timeout {NO_TIMEDOUT};
 
     // waiting for first byte (per iteration) in long connection
@@ -120,6 +224,11 @@ private:
 
     detail::Codec _codec;
 
+    detail::Admission _admission;
+
+    // metrics of the methods in current thread
+    detail::MetricsCache _metrics;
+
     std::function<bool(ProtocolType &)> _requestCallback;
     std::function<bool(ProtocolType &)> _responseCallback;
 };
@@ -127,34 +236,70 @@ private:
 inline void Server::start() {
     // if(!co::test()) warn();
     auto &env = co::open();
+    freeze();
+    _metrics.reset();
+    if(_loopback) {
+        serveInProcess();
+        return;
+    }
     if(::listen(_fd, SOMAXCONN)) {
         _errno = errno;
         return;
     }
     while(1) {
         Endpoint peerEndpoint;
-        socklen_t len = sizeof peerEndpoint;
-        int peerFd = co::accept4(_fd, (sockaddr*)&peerEndpoint, &len,
+        int peerFd = co::accept4(_fd, peerEndpoint.data(), &peerEndpoint.length,
             SOCK_CLOEXEC | SOCK_NONBLOCK);
         if(peerFd < 0) continue;
+        // refused as soon as possible, rather than kept in backlog
+        if(!_admission.connect()) {
+            ::close(peerFd);
+            continue;
+        }
+        // responses are coalesced by onAccept() instead of Nagle's algorithm
+        detail::noDelay(peerFd, _endpoint.family());
+        peerEndpoint.sharedMemory = _endpoint.sharedMemory;
         auto worker = env.createCoroutine([=] {
-            onAccept(peerFd, peerEndpoint);
+            auto &shard = detail::Shard::local();
+            auto connection = shard.connect(peerEndpoint);
+            if(_endpoint.sharedMemory) {
+                // the socket is only for handshake and hangup then
+                auto ring = detail::RingStream::offer(peerFd, Deadline::Clock::now() + _timeout);
+                if(ring) onAccept(*ring, *connection);
+                else _errno = errno;
+            } else {
+                detail::SocketStream stream {peerFd};
+                onAccept(stream, *connection);
+            }
+            shard.disconnect(connection);
             ::close(peerFd);
+            _admission.disconnect();
         });
         worker->resume();
     }
 }
 
 inline void Server::close() {
+    if(_loopback) {
+        _loopback->close();
+        _loopback.reset();
+    }
     if(_fd != SOCKET_INVALID) {
         ::close(_fd);
         _fd = SOCKET_INVALID;
+        if(isSocketFile(_endpoint)) {
+            ::unlink(_endpoint.local.sun_path);
+        }
     }
 }
 
 template <typename F>
 inline void Server::bind(const std::string &method, const F &func) {
-    _table[method] = detail::CallProxy<F>(func);
+    _table.bind(method, detail::Method::make(func));
+}
+
+inline void Server::freeze() {
+    _table.freeze();
 }
 
 inline int Server::error() {
@@ -171,6 +316,10 @@ inline void Server::setPending(std::chrono::milliseconds pending) {
     _pending = pending;
 }
 
+inline void Server::setLimits(Limits limits) {
+    _admission.reset(limits);
+}
+
 template <typename Func>
 inline void Server::onRequest(Func &&requestCallback) {
     _requestCallback = std::forward<Func>(requestCallback);
@@ -189,12 +338,15 @@ inline Server::Server(Endpoint endpoint)
 
 inline Server::Server(Server &&rhs)
     : _fd(rhs._fd),
+      _loopback(std::move(rhs._loopback)),
       _endpoint(rhs._endpoint),
       _errno(rhs._errno),
       _table(std::move(rhs._table)),
       _timeout(rhs._timeout),
       _pending(rhs._pending),
       _codec(rhs._codec),
+      _admission(rhs._admission),
+      _metrics(rhs._metrics),
       _requestCallback(std::move(rhs._requestCallback)),
       _responseCallback(std::move(rhs._responseCallback))
 {
@@ -211,23 +363,48 @@ inline Server::~Server() {
 }
 
 inline void Server::init() {
-    _fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
-    if(_fd < 0) {
-        _errno = errno;
+    if(_endpoint.inProcess) {
+        _loopback = detail::Loopback::bind(_endpoint.name());
+        if(!_loopback) _errno = errno;
         return;
     }
-    int opt = 1;
-    if(::setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &opt,
-            static_cast<socklen_t>(sizeof opt))) {
+    _fd = ::socket(_endpoint.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(_fd < 0) {
         _errno = errno;
         return;
     }
-    if(::setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &opt,
-            static_cast<socklen_t>(sizeof opt))) {
-        _errno = errno;
-        return;
+    if(_endpoint.family() == AF_UNIX) {
+        // like SO_REUSEADDR, but only a socket file can be replaced
+        struct stat st;
+        if(isSocketFile(_endpoint) && !::lstat(_endpoint.local.sun_path, &st) && S_ISSOCK(st.st_mode)) {
+            ::unlink(_endpoint.local.sun_path);
+        }
+    } else {
+        int opt = 1;
+        if(::setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &opt,
+                static_cast<socklen_t>(sizeof opt))) {
+            _errno = errno;
+            return;
+        }
+        if(::setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &opt,
+                static_cast<socklen_t>(sizeof opt))) {
+            _errno = errno;
+            return;
+        }
+        // dual-stack: "[::]:port" accepts IPv4 peers as well (as ::ffff:a.b.c.d)
+        int v6only = 0;
+        if(_endpoint.family() == AF_INET6 && ::setsockopt(_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only,
+                static_cast<socklen_t>(sizeof v6only))) {
+            _errno = errno;
+            return;
+        }
+        // inherited by accepted sockets on Linux, and set again in start()
+        if(!detail::noDelay(_fd, _endpoint.family())) {
+            _errno = errno;
+            return;
+        }
     }
-    if(::bind(_fd, (const sockaddr*)&_endpoint, sizeof _endpoint)) {
+    if(::bind(_fd, _endpoint.data(), _endpoint.size())) {
         _errno = errno;
         return;
     }
@@ -236,12 +413,15 @@ inline void Server::init() {
 inline void Server::swap(Server &that) {
     using std::swap;
     swap(this->_fd, that._fd);
+    swap(this->_loopback, that._loopback);
     swap(this->_endpoint, that._endpoint);
     swap(this->_table, that._table);
     swap(this->_errno, that._errno);
     swap(this->_timeout, that._timeout);
     swap(this->_pending, that._pending);
     swap(this->_codec, that._codec);
+    swap(this->_admission, that._admission);
+    swap(this->_metrics, that._metrics);
     swap(this->_requestCallback, that._requestCallback);
     swap(this->_responseCallback, that._responseCallback);
 }
@@ -253,28 +433,343 @@ inline std::optional<Server> Server::make(Endpoint endpoint) {
     return server;
 }
 
-inline Server::ProtocolType Server::netCall(const std::string &method, ProtocolType args) {
-    auto methodHandle = _table.find(method);
-    if(methodHandle != _table.end()) {
-        auto &proxy = methodHandle->second;
-        return proxy(std::move(args));
+inline Server::ProtocolType Server::netCall(const ProtocolType &method, detail::Params &params,
+                                           detail::Sample &sample) {
+    size_t id = detail::MethodTable::NOT_FOUND;
+    if(method.is<std::string>()) {
+        auto name = method.to<std::string_view>();
+        if(name.compare(0, sizeof(detail::protocol::Builtin::prefix) - 1,
+                detail::protocol::Builtin::prefix) == 0) {
+            return builtinCall(name, params, sample);
+        }
+        id = _table.id(name);
+    } else if(method.is<vsjson::IntegerImpl>()) {
+        // negotiated by rpc.methods, dispatch by index
+        auto index = method.to<int64_t>();
+        if(index >= 0) id = static_cast<size_t>(index);
     } else {
+        throw detail::protocol::Exception::makeInvalidRequestException();
+    }
+    auto proxy = _table.find(id);
+    if(!proxy) {
         throw detail::protocol::Exception::makeMethodNotFoundException();
     }
+    sample.method = _metrics.method(id, _table.name(id));
+    return (*proxy)(params);
+}
+
+inline Server::ProtocolType Server::builtinCall(std::string_view method, detail::Params &params,
+                                               detail::Sample &sample) {
+    if(method == detail::protocol::Builtin::methods) {
+        sample.method = _metrics.method(method);
+        if(params.size() != 0) {
+            throw detail::protocol::Exception::makeInvalidParamsException();
+        }
+        ProtocolType names = vsjson::Json::array();
+        for(size_t id = 0; id < _table.size(); ++id) {
+            names.append(_table.name(id));
+        }
+        return names;
+    }
+    if(method == detail::protocol::Builtin::stats) {
+        sample.method = _metrics.method(method);
+        if(params.size() != 0) {
+            throw detail::protocol::Exception::makeInvalidParamsException();
+        }
+        return Stats::report();
+    }
+    throw detail::protocol::Exception::makeMethodNotFoundException();
+}
+
+template <typename Call>
+inline int Server::invoke(ProtocolType &response, Call &&call) {
+    // try-catch can capture all the exceptions without modifying CallProxy function signatures
+    //     and remote exceptions in any bound function can be rethrown to RPC client
+    // TODO auto [result, err, errorLayer] = netCall(...)
+    auto fail = [&](const detail::protocol::Exception &e) {
+        _codec.reportError(response, e);
+        return e.code();
+    };
+    try {
+        auto result = call();
+        _codec.fillResultToResponse(response, std::move(result));
+        return 0;
+    } catch(const detail::protocol::Exception &e) {
+        return fail(e);
+    } catch(const detail::Codec::InstanceException &e) {
+        return fail(detail::protocol::Exception::makeParseErrorException());
+    } catch(const std::exception &e) {
+        return fail(detail::protocol::Exception::makeInternalErrorException());
+    }
+}
+
+template <typename Call>
+inline int Server::invokeQuietly(Call &&call) {
+    try {
+        call();
+        return 0;
+    } catch(const detail::protocol::Exception &e) {
+        return e.code();
+    } catch(const detail::Codec::InstanceException &e) {
+        return detail::protocol::Attribute::parseErrorCode;
+    } catch(const std::exception &e) {
+        return detail::protocol::Attribute::internalErrorCode;
+    }
+}
+
+template <typename Call>
+inline Server::ProtocolType Server::execute(Deadline::TimePoint deadline, detail::Sample &sample,
+                                            Call &&call) {
+    auto expired = [deadline] {
+        return deadline != Deadline::NEVER && deadline <= Deadline::Clock::now();
+    };
+    if(expired()) {
+        throw detail::protocol::Exception::makeDeadlineExceededException();
+    }
+    sample.enter(detail::QUEUEING);
+    auto ticket = _admission.admit(deadline);
+    if(!ticket) {
+        if(expired()) throw detail::protocol::Exception::makeDeadlineExceededException();
+        throw detail::protocol::Exception::makeOverloadedException();
+    }
+    sample.enter(detail::HANDLER);
+    if(deadline == Deadline::NEVER) {
+        return call();
+    }
+    Deadline scope {deadline};
+    return call();
+}
+
+inline void Server::record(detail::Sample &sample) {
+    sample.finish();
+    if(!sample.method) sample.method = _metrics.unknown();
+    sample.method->record(sample);
+}
+
+inline std::optional<Server::ProtocolType> Server::respond(ProtocolType &request) {
+    auto arrival = Deadline::Clock::now();
+    detail::Sample sample {arrival};
+    std::optional<ProtocolType> response;
+    if(request.is<vsjson::ArrayImpl>()) {
+        auto responses = handleBatch(request, arrival, sample);
+        if(!responses.is<vsjson::NullImpl>()) response = std::move(responses);
+    } else {
+        response = handle(request, arrival, sample);
+    }
+    if(response && _responseCallback && !_responseCallback(*response)) {
+        response.reset();
+    }
+    record(sample);
+    return response;
+}
+
+inline void Server::serveInProcess() {
+    auto &env = co::open();
+    _loopback->listen([this](ProtocolType &request) { return respond(request); });
+    // keep it, close() releases _loopback
+    auto loopback = _loopback;
+    while(auto stream = loopback->accept()) {
+        if(!_admission.connect()) {
+            stream->close();
+            continue;
+        }
+        // unnamed, like a connecting unix domain socket
+        Endpoint peerEndpoint = _endpoint;
+        peerEndpoint.length = offsetof(sockaddr_un, sun_path);
+        auto worker = env.createCoroutine([=] {
+            auto &shard = detail::Shard::local();
+            auto connection = shard.connect(peerEndpoint);
+            onAccept(*stream, *connection);
+            shard.disconnect(connection);
+            stream->close();
+            _admission.disconnect();
+        });
+        worker->resume();
+    }
+}
+
+inline Server::ProtocolType Server::handle(const char *text, Deadline::TimePoint arrival, vsjson::Resource *resource,
+                                          detail::Sample &sample, bool batched) {
+    std::optional<vsjson::LazyObject> request;
+    try {
+        request.emplace(text);
+        if(!batched) vsjson::parser::expectEnd(request->end());
+    } catch(const detail::Codec::InstanceException &e) {
+        // id is unknown
+        auto response = detail::makeEmptyResponse();
+        auto error = detail::protocol::Exception::makeParseErrorException();
+        _codec.reportError(response, error);
+        sample.error = error.code();
+        return response;
+    }
+    auto call = [&] {
+        auto deadline = _codec.deadline(*request, arrival, resource);
+        auto [method, args] = _codec.prepareNetCall(*request, resource);
+        detail::Params params {args, resource};
+        return execute(deadline, sample, [&] { return netCall(method, params, sample); });
+    };
+    if(!request->contains(detail::protocol::Field::id)) {
+        sample.error = invokeQuietly(call);
+        return nullptr;
+    }
+    auto response = detail::makeEmptyResponse(*request, resource);
+    sample.error = invoke(response, call);
+    return response;
 }
 
-inline void Server::onAccept(int peerFd, Endpoint peerEndpoint) {
+inline Server::ProtocolType Server::handleBatch(const char *text, Deadline::TimePoint arrival, vsjson::Resource *resource,
+                                               detail::Sample &sample) {
+    sample.method = _metrics.batch();
+    std::optional<vsjson::LazyArray> requests;
+    try {
+        requests.emplace(text);
+        vsjson::parser::expectEnd(requests->end());
+    } catch(const detail::Codec::InstanceException &e) {
+        auto response = detail::makeEmptyResponse();
+        auto error = detail::protocol::Exception::makeParseErrorException();
+        _codec.reportError(response, error);
+        sample.error = error.code();
+        return response;
+    }
+    // an empty batch is an invalid request, answered by a single response
+    if(requests->size() == 0) {
+        auto response = detail::makeEmptyResponse();
+        auto error = detail::protocol::Exception::makeInvalidRequestException();
+        _codec.reportError(response, error);
+        sample.error = error.code();
+        return response;
+    }
+    sample.enter(detail::HANDLER);
+    // executed one by one in order
+    ProtocolType responses = vsjson::ArrayImpl(vsjson::ArrayImpl::allocator_type(resource));
+    auto &array = responses.as<vsjson::ArrayImpl>();
+    array.reserve(requests->size());
+    for(size_t i = 0; i < requests->size(); ++i) {
+        auto &request = (*requests)[i];
+        detail::Sample element;
+        if(!request.isObject()) {
+            auto response = detail::makeEmptyResponse();
+            auto error = detail::protocol::Exception::makeInvalidRequestException();
+            _codec.reportError(response, error);
+            element.error = error.code();
+            array.emplace_back(std::move(response));
+        } else {
+            auto response = handle(request.begin, arrival, resource, element, true);
+            if(!response.is<vsjson::NullImpl>()) {
+                array.emplace_back(std::move(response));
+            }
+        }
+        record(element);
+        // a batch fails with its first error
+        if(!sample.error) sample.error = element.error;
+    }
+    // all notifications
+    if(array.empty()) {
+        return nullptr;
+    }
+    return responses;
+}
+
+inline std::optional<Server::ProtocolType> Server::handle(ProtocolType &request, Deadline::TimePoint arrival,
+                                                          detail::Sample &sample) {
+    if(_requestCallback && !_requestCallback(request)) {
+        return std::nullopt;
+    }
+    bool notification = !request.contains(detail::protocol::Field::id);
+    auto response = notification ? ProtocolType(nullptr) : detail::makeEmptyResponse(request);
+    // a bad timeout is reported like any other bad request
+    std::optional<Deadline::TimePoint> deadline;
+    try {
+        deadline = _codec.deadline(request, arrival);
+    } catch(const detail::protocol::Exception &e) {
+        sample.error = e.code();
+        if(notification) return std::nullopt;
+        _codec.reportError(response, e);
+        return response;
+    }
+    // TODO lvalue
+    // (structured bindings cannot be captured in C++17)
+    auto call = _codec.prepareNetCall(std::move(request));
+    detail::Params params {std::get<1>(call)};
+    auto netCallLater = [&] {
+        return execute(*deadline, sample, [&] { return netCall(std::get<0>(call), params, sample); });
+    };
+    if(notification) {
+        sample.error = invokeQuietly(netCallLater);
+        return std::nullopt;
+    }
+    sample.error = invoke(response, netCallLater);
+    return response;
+}
+
+inline Server::ProtocolType Server::handleBatch(ProtocolType &requests, Deadline::TimePoint arrival,
+                                               detail::Sample &sample) {
+    sample.method = _metrics.batch();
+    if(requests.arraySize() == 0) {
+        auto response = detail::makeEmptyResponse();
+        auto error = detail::protocol::Exception::makeInvalidRequestException();
+        _codec.reportError(response, error);
+        sample.error = error.code();
+        return response;
+    }
+    sample.enter(detail::HANDLER);
+    ProtocolType responses = vsjson::Json::array();
+    for(size_t i = 0; i < requests.arraySize(); ++i) {
+        auto &request = requests[i];
+        detail::Sample element;
+        if(!request.is<vsjson::ObjectImpl>()) {
+            auto response = detail::makeEmptyResponse();
+            auto error = detail::protocol::Exception::makeInvalidRequestException();
+            _codec.reportError(response, error);
+            element.error = error.code();
+            responses.append(std::move(response));
+        } else if(auto response = handle(request, arrival, element)) {
+            responses.append(std::move(*response));
+        }
+        record(element);
+        if(!sample.error) sample.error = element.error;
+    }
+    // all dropped or notifications
+    if(responses.arraySize() == 0) {
+        return nullptr;
+    }
+    return responses;
+}
+
+template <typename Stream>
+inline void Server::onAccept(Stream &peer, detail::ConnectionMetrics &connection) {
     char buf[BUF_SIZE_ON_STACK];
+    // per-connection arena for request/response json trees, and response buffer
+    auto &pool = detail::ScratchPool::local();
+    auto scratch = pool.acquire();
+    auto &arena = scratch->arena;
+    auto &outbound = scratch->outbound;
+    // the next request is known to be readable, no need to wait
+    bool readable = false;
+    // created by the first cork, see corkTimer()
+    auto cork = std::make_shared<detail::Cork>();
+    std::shared_ptr<co::Coroutine> timer;
     while(1) {
+        // all the json objects of last iteration have been destroyed
+        // release them at once
+        arena.reset();
         char *cur = buf;
         using Header = detail::Codec::Header;
+        // no-op unless TRPC_TRACING, see trpc::Tracing
+        detail::ServerTracer trace;
+        trace.begin();
+        if(cork->broken) {
+            break;
+        }
         // TODO long connection should enlarge timeout here
-        if(!bestEffortPending(peerFd)) {
+        if(!readable && !bestEffortPending(peer)) {
             break;
         }
-        if(!bestEffortRead(peerFd, buf, sizeof(Header))) {
+        trace.stamp(Trace::PENDING);
+        if(!bestEffortRead(peer, buf, sizeof(Header))) {
             break;
         }
+        trace.stamp(Trace::HEADER);
         auto [headerVerified, contentLength] = _codec.contentLength(cur, sizeof(Header));
         if(!headerVerified) {
             _errno = EPROTO;
@@ -283,57 +778,102 @@ inline void Server::onAccept(int peerFd, Endpoint peerEndpoint) {
 
         cur += sizeof(Header);
 
-        if(!bestEffortRead(peerFd, cur, contentLength)) {
+        // and a '\0' after it
+        if(sizeof(Header) + contentLength >= sizeof buf) {
+            _errno = EMSGSIZE;
             break;
         }
 
+        if(!bestEffortRead(peer, cur, contentLength)) {
+            break;
+        }
+        trace.stamp(Trace::BODY);
+
         auto totalLength = sizeof(Header) + contentLength;
+        // the json parser stops only at '\0', not after the frame
+        buf[totalLength] = '\0';
         if(!_codec.verify(buf, totalLength)) {
             _errno = EPROTO;
             break;
         }
 
-        auto request = _codec.decode(buf, totalLength);
-
-        if(_requestCallback && !_requestCallback(request)) {
-            continue;
+        auto arrival = Deadline::Clock::now();
+
+        // recorded when this iteration ends, replied or not
+        detail::Sample sample {arrival};
+        sample.bytesIn = totalLength;
+
+        // null: nothing to reply (notifications, or requests dropped by callback)
+        ProtocolType response = nullptr;
+
+        if(_requestCallback) {
+            // eager mode: the callback may inspect or modify the whole request
+            auto request = _codec.decode(buf, totalLength, arena.resource());
+            if(request.is<vsjson::ArrayImpl>()) {
+                response = handleBatch(request, arrival, sample);
+            } else if(auto single = handle(request, arrival, sample)) {
+                response = std::move(*single);
+            }
+        } else if(_codec.isBatch(buf, totalLength)) {
+            response = handleBatch(_codec.content(buf), arrival, arena.resource(), sample);
+        } else {
+            response = handle(_codec.content(buf), arrival, arena.resource(), sample);
         }
 
-        auto response = detail::makeEmptyResponse(request);
-
-        // TODO lvalue
-        auto [method, args] = _codec.prepareNetCall(std::move(request));
-
-        // try-catch can capture all the exceptions without modifying CallProxy function signatures
-        //     and remote exceptions in any bound function can be rethrown to RPC client
-        // TODO auto [result, err, errorLayer] = netCall(...)
-        try {
-            auto result = netCall(method, std::move(args));
-            _codec.fillResultToResponse(response, std::move(result));
-        } catch(const detail::protocol::Exception &e) {
-            _codec.reportError(response, e);
-        } catch(const detail::Codec::InstanceException &e) {
-            _codec.reportError(response, detail::protocol::Exception::makeParseErrorException());
-        } catch(const std::exception &e) {
-            _codec.reportError(response, detail::protocol::Exception::makeInternalErrorException());
-        }
+        bool reply = !response.is<vsjson::NullImpl>()
+            && (!_responseCallback || _responseCallback(response));
 
-        if(_responseCallback && !_responseCallback(response)) {
-            continue;
+        if(reply) {
+            sample.enter(detail::ENCODE);
+            sample.bytesOut = outbound.push(response, _codec, arrival);
         }
 
-        auto [dump, responseLength, responseBeLength] = _codec.dump(response);
+        // counted before the peer can see the response
+        record(sample);
+        connection.record(sample);
+        trace.finish(sample, connection.peer);
 
-        if(!bestEffortWrite(peerFd, &responseBeLength, sizeof(Header))
-                || !bestEffortWrite(peerFd, dump.c_str(), responseLength)) {
-            break;
+        // corked while the next request is already readable (pipelined)
+        readable = !outbound.empty() && peer.readable();
+        if(outbound.empty()) {
+            continue;
         }
-
+        if(!readable || outbound.due(Deadline::Clock::now())) {
+            if(!flush(peer, outbound)) {
+                break;
+            }
+        } else if(!timer) {
+            timer = corkTimer(peer, outbound, cork);
+            timer->resume();
+        } else if(cork->idle) {
+            timer->resume();
+        }
+    }
+    // replies to the requests before FIN (or a bad frame)
+    if(!outbound.empty() && !cork->broken) {
+        flush(peer, outbound);
+    }
+    // the stream and the queue go away with this frame
+    while(outbound.writing()) {
+        co::usleep(MAX_FLUSH_WAIT.count());
     }
+    // an idle timer returns now, an asleep one when it wakes up
+    cork->closed = true;
+    if(timer && cork->idle) {
+        timer->resume();
+    }
+    pool.release(std::move(scratch));
+}
+
+inline bool Server::isSocketFile(const Endpoint &endpoint) {
+    return endpoint.family() == AF_UNIX
+        && endpoint.size() > offsetof(sockaddr_un, sun_path)
+        && endpoint.local.sun_path[0] != '\0';
 }
 
-inline bool Server::bestEffortRead(int peer, const void *buf, size_t size, size_t maxRetries) {
-    if(detail::bestEffortRead(peer, buf, size, _timeout, maxRetries) == size) {
+template <typename Stream>
+inline bool Server::bestEffortRead(Stream &peer, void *buf, size_t size) {
+    if(peer.read(buf, size, size, Deadline::Clock::now() + _timeout) == size) {
         return true;
     }
     if(!(_errno = errno)) {
@@ -344,8 +884,9 @@ inline bool Server::bestEffortRead(int peer, const void *buf, size_t size, size_
     return false;
 }
 
-inline bool Server::bestEffortWrite(int peer, const void *buf, size_t size, size_t maxRetries) {
-    if(detail::bestEffortWrite(peer, buf, size, _timeout, maxRetries) == size) {
+template <typename Stream>
+inline bool Server::bestEffortWrite(Stream &peer, const void *buf, size_t size) {
+    if(peer.write(buf, size, Deadline::Clock::now() + _timeout) == size) {
         return true;
     }
     if(!(_errno = errno)) {
@@ -354,14 +895,48 @@ inline bool Server::bestEffortWrite(int peer, const void *buf, size_t size, size
     return false;
 }
 
-inline bool Server::bestEffortPending(int peer) {
-    constexpr static ssize_t FIRST_BYTE = 1;
-    auto hook = [=](int peer, const void *, size_t /*same as return value*/) {
-        return FIRST_BYTE;
-    };
-    // internal poll mode must be LT
-    // because we don't actually read 1 byte
-    if(detail::bestEffortTemplate(hook, POLLIN, peer, nullptr, FIRST_BYTE, _pending, 1) == FIRST_BYTE) {
+template <typename Stream>
+inline bool Server::flush(Stream &peer, detail::Outbound &outbound) {
+    // the frames taken by the timer go first (it waits for a full socket)
+    while(outbound.writing()) {
+        co::usleep(MAX_FLUSH_WAIT.count());
+    }
+    auto &frames = outbound.take();
+    bool written = bestEffortWrite(peer, frames.data(), frames.size());
+    outbound.done();
+    return written;
+}
+
+template <typename Stream>
+inline std::shared_ptr<co::Coroutine> Server::corkTimer(Stream &peer, detail::Outbound &outbound,
+                                                        std::shared_ptr<detail::Cork> cork) {
+    return co::open().createCoroutine([this, &peer, &outbound, cork] {
+        using namespace std::chrono;
+        while(!cork->closed) {
+            if(outbound.empty()) {
+                cork->idle = true;
+                co::this_coroutine::yield();
+                cork->idle = false;
+                continue;
+            }
+            // a flush in progress is given a whole delay
+            auto delay = outbound.writing() ? detail::Outbound::MAX_DELAY
+                : ceil<microseconds>(outbound.deadline() - Deadline::Clock::now());
+            co::usleep(std::max<int64_t>(delay.count(), 1));
+            if(cork->closed) {
+                break;
+            }
+            if(!outbound.writing() && !outbound.empty() && outbound.due(Deadline::Clock::now())
+                    && !flush(peer, outbound)) {
+                cork->broken = true;
+            }
+        }
+    });
+}
+
+template <typename Stream>
+inline bool Server::bestEffortPending(Stream &peer) {
+    if(peer.pending(Deadline::Clock::now() + _pending)) {
         return true;
     }
     if(!(_errno = errno)) {
@@ -0,0 +1,148 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "vsjson.hpp"
+#include "Endpoint.h"
+#include "Histogram.h"
+#include "detail/Metrics.h"
+namespace trpc {
+
+// server metrics of this process
+//
+// recorded by every trpc::Server in per-thread shards, and merged when read
+// also served by the built-in method "rpc.stats" (see report())
+class Stats {
+public:
+    using Phase = detail::Phase;
+
+    struct Method {
+        uint64_t                              requests {};
+        // JSON-RPC error code -> count
+        std::map<int, uint64_t>               errors;
+        uint64_t                              bytesIn {};
+        uint64_t                              bytesOut {};
+        // heap allocations, only counted with TRPC_COUNT_ALLOCATIONS (see detail::Allocations)
+        uint64_t                              allocations {};
+        // nanoseconds, indexed by Phase
+        std::array<Histogram, Phase::PHASES>  latency;
+    };
+
+    struct Connection {
+        Endpoint peer;
+        // a batch is one request
+        uint64_t requests {};
+        uint64_t errors {};
+        uint64_t bytesIn {};
+        uint64_t bytesOut {};
+    };
+
+public:
+    // method name -> metrics, cumulative since start
+    // "<unknown>": requests before the method is known (e.g. parse errors)
+    // "<batch>": batch frames, elements are counted by their own methods
+    static std::map<std::string, Method> methods();
+
+    // open connections
+    static std::vector<Connection> connections();
+
+    // {"methods": {name: {"requests", "errors": {code: n}, "bytesIn", "bytesOut",
+    //                     "latency": {phase: {"count", "mean", "p50", "p90", "p99", "p999", "max"}},
+    //                     "allocations" (only if counted)}},
+    //  "connections": [{"peer", "requests", "errors", "bytesIn", "bytesOut"}]}
+    // latency is in microseconds
+    static vsjson::Json report();
+};
+
+inline std::map<std::string, Stats::Method> Stats::methods() {
+    std::map<std::string, Method> merged;
+    for(auto &shard : detail::Shard::all()) {
+        std::lock_guard<std::mutex> _ {shard->mutex};
+        for(auto &[name, metrics] : shard->methods) {
+            auto &method = merged[name];
+            method.requests += metrics->requests.get();
+            metrics->errors.forEach([&](int code, uint64_t count) {
+                method.errors[code] += count;
+            });
+            method.bytesIn += metrics->bytesIn.get();
+            method.bytesOut += metrics->bytesOut.get();
+            method.allocations += metrics->allocations.get();
+            for(size_t phase = 0; phase < Phase::PHASES; ++phase) {
+                method.latency[phase].merge(metrics->latency[phase]);
+            }
+        }
+    }
+    return merged;
+}
+
+inline std::vector<Stats::Connection> Stats::connections() {
+    std::vector<Connection> connections;
+    for(auto &shard : detail::Shard::all()) {
+        std::lock_guard<std::mutex> _ {shard->mutex};
+        for(auto &metrics : shard->connections) {
+            Connection connection;
+            connection.peer = metrics.peer;
+            connection.requests = metrics.requests.get();
+            connection.errors = metrics.errors.get();
+            connection.bytesIn = metrics.bytesIn.get();
+            connection.bytesOut = metrics.bytesOut.get();
+            connections.emplace_back(connection);
+        }
+    }
+    return connections;
+}
+
+inline vsjson::Json Stats::report() {
+    auto micros = [](double nanoseconds) { return nanoseconds / 1000; };
+    vsjson::Json methodsJson;
+    for(auto &[name, method] : methods()) {
+        vsjson::Json errors;
+        for(auto [code, count] : method.errors) {
+            errors[std::to_string(code)] = count;
+        }
+        vsjson::Json latency;
+        for(size_t phase = 0; phase < Phase::PHASES; ++phase) {
+            auto &h = method.latency[phase];
+            if(h.count() == 0) continue;
+            latency[detail::phaseName(Phase(phase))] = {
+                {"count", h.count()},
+                {"mean", micros(h.mean())},
+                {"p50", micros(h.percentile(0.5))},
+                {"p90", micros(h.percentile(0.9))},
+                {"p99", micros(h.percentile(0.99))},
+                {"p999", micros(h.percentile(0.999))},
+                {"max", micros(h.max())},
+            };
+        }
+        methodsJson[name] = {
+            {"requests", method.requests},
+            {"errors", std::move(errors)},
+            {"bytesIn", method.bytesIn},
+            {"bytesOut", method.bytesOut},
+            {"latency", std::move(latency)},
+        };
+        if(detail::Allocations::counting()) {
+            methodsJson[name]["allocations"] = method.allocations;
+        }
+    }
+    vsjson::Json connectionsJson = vsjson::Json::array();
+    for(auto &connection : connections()) {
+        connectionsJson.append({
+            {"peer", connection.peer.toString()},
+            {"requests", connection.requests},
+            {"errors", connection.errors},
+            {"bytesIn", connection.bytesIn},
+            {"bytesOut", connection.bytesOut},
+        });
+    }
+    return {
+        {"methods", std::move(methodsJson)},
+        {"connections", std::move(connectionsJson)},
+    };
+}
+
+} // trpc
@@ -0,0 +1,281 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "vsjson.hpp"
+#include "Endpoint.h"
+#include "detail/Metrics.h"
+#include "detail/PerThread.h"
+namespace trpc {
+
+// timeline of a server request, stages are in order
+struct Trace {
+    using Clock = std::chrono::steady_clock;
+
+    enum Stage {
+        // waiting for the first byte (idle time of a long connection)
+        PENDING,
+        HEADER,
+        BODY,
+        // see detail::Phase
+        DECODE,
+        QUEUEING,
+        HANDLER,
+        ENCODE,
+        WRITE,
+        STAGES
+    };
+
+    static const char* stageName(Stage stage);
+
+    // the first byte is readable
+    Clock::time_point                 start;
+    // nanoseconds, indexed by Stage
+    std::array<uint64_t, STAGES>      elapsed;
+    // truncated
+    char                              method[32];
+    // JSON-RPC error code, 0 if succeeded
+    int                               error;
+    // heap allocations, see detail::Allocations
+    uint64_t                          allocations;
+    Endpoint                          peer;
+
+    // latency of the request, excluding PENDING
+    uint64_t total() const;
+};
+
+namespace detail {
+
+// recent traces of one thread, the oldest one is overwritten
+// a slot is a seqlock, readers retry (skip) a slot being written
+class TraceRing {
+public:
+    constexpr static size_t CAPACITY = 1024;
+
+    void push(const Trace &trace);
+
+    // append the traces to `out`, the newest first
+    void collect(std::vector<Trace> &out) const;
+
+private:
+    struct Slot {
+        // odd while writing
+        std::atomic<uint64_t> sequence {};
+        Trace                 trace;
+    };
+
+    std::array<Slot, CAPACITY> _slots;
+    std::atomic<uint64_t>      _next {};
+};
+
+// tracing policy of trpc::Server
+// Tracer<false> is empty and every call is a no-op, so it compiles to nothing
+template <bool Enabled>
+class Tracer;
+
+template <>
+class Tracer<false> {
+public:
+    constexpr static bool enabled = false;
+
+    void begin() {}
+    void stamp(Trace::Stage) {}
+    void finish(const Sample&, const Endpoint&) {}
+};
+
+template <>
+class Tracer<true> {
+public:
+    constexpr static bool enabled = true;
+
+    // waiting for a request
+    void begin();
+    // the stage (PENDING, HEADER or BODY) ends now
+    // whether the request is sampled is decided at the end of PENDING
+    void stamp(Trace::Stage stage);
+    // the rest of stages are taken from the finished sample
+    void finish(const Sample &sample, const Endpoint &peer);
+
+    // sample 1 of every `n` requests, 0 means none
+    static std::atomic<uint32_t>& every();
+
+private:
+    bool                     _sampled {};
+    Trace::Clock::time_point _mark;
+    Trace                    _trace {};
+};
+
+#ifdef TRPC_TRACING
+using ServerTracer = Tracer<true>;
+#else
+using ServerTracer = Tracer<false>;
+#endif
+
+} // detail
+
+// request tracing of this process
+//
+// disabled unless compiled with TRPC_TRACING, then every function is a no-op
+// when enabled, each server thread keeps its last detail::TraceRing::CAPACITY sampled requests
+class Tracing {
+public:
+    constexpr static bool enabled = detail::ServerTracer::enabled;
+
+    // in [0, 1], 1 (all requests) by default
+    static void setSampleRate(double rate);
+
+    // the newest first
+    static std::vector<Trace> recent();
+
+    // recent requests slower than `threshold`, the slowest first
+    static std::vector<Trace> slow(std::chrono::nanoseconds threshold);
+
+    // [{"method", "peer", "error", "total", "stages": {stage: elapsed}}], in microseconds
+    // with "allocations" if they are counted, see detail::Allocations
+    static vsjson::Json report(std::chrono::nanoseconds threshold);
+};
+
+inline const char* Trace::stageName(Stage stage) {
+    constexpr const char *names[] {"pending", "header", "body", "decode",
+                                   "queueing", "handler", "encode", "write"};
+    return names[stage];
+}
+
+inline uint64_t Trace::total() const {
+    uint64_t sum = 0;
+    for(size_t stage = HEADER; stage < STAGES; ++stage) sum += elapsed[stage];
+    return sum;
+}
+
+inline void detail::TraceRing::push(const Trace &trace) {
+    // single writer
+    auto next = _next.load(std::memory_order_relaxed);
+    auto &slot = _slots[next % CAPACITY];
+    auto sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.trace = trace;
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    _next.store(next + 1, std::memory_order_release);
+}
+
+inline void detail::TraceRing::collect(std::vector<Trace> &out) const {
+    auto next = _next.load(std::memory_order_acquire);
+    auto size = std::min<uint64_t>(next, CAPACITY);
+    for(uint64_t i = 1; i <= size; ++i) {
+        auto &slot = _slots[(next - i) % CAPACITY];
+        auto before = slot.sequence.load(std::memory_order_acquire);
+        if(before == 0 || (before & 1)) continue;
+        Trace trace = slot.trace;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot.sequence.load(std::memory_order_relaxed) != before) continue;
+        out.emplace_back(trace);
+    }
+}
+
+inline void detail::Tracer<true>::begin() {
+    // decided when the first byte arrives
+    _sampled = every().load(std::memory_order_relaxed) != 0;
+    if(_sampled) _mark = Trace::Clock::now();
+}
+
+inline void detail::Tracer<true>::stamp(Trace::Stage stage) {
+    if(!_sampled) return;
+    if(stage == Trace::PENDING) {
+        static thread_local uint32_t count = 0;
+        auto n = every().load(std::memory_order_relaxed);
+        _sampled = n && ++count % n == 0;
+        if(!_sampled) return;
+    }
+    auto now = Trace::Clock::now();
+    _trace.elapsed[stage] = std::chrono::nanoseconds(now - _mark).count();
+    if(stage == Trace::PENDING) _trace.start = now;
+    _mark = now;
+}
+
+inline void detail::Tracer<true>::finish(const Sample &sample, const Endpoint &peer) {
+    if(!_sampled) return;
+    constexpr std::pair<Trace::Stage, Phase> phases[] {
+        {Trace::DECODE, DECODE}, {Trace::QUEUEING, QUEUEING}, {Trace::HANDLER, HANDLER},
+        {Trace::ENCODE, ENCODE}, {Trace::WRITE, WRITE},
+    };
+    for(auto [stage, phase] : phases) {
+        _trace.elapsed[stage] = std::chrono::nanoseconds(sample.elapsed(phase)).count();
+    }
+    ::memset(_trace.method, 0, sizeof _trace.method);
+    if(sample.method) {
+        auto name = sample.method->name;
+        ::memcpy(_trace.method, name.data(), std::min(name.size(), sizeof _trace.method - 1));
+    }
+    _trace.error = sample.error;
+    _trace.allocations = sample.allocations;
+    _trace.peer = peer;
+    PerThread<TraceRing>::local().push(_trace);
+}
+
+inline std::atomic<uint32_t>& detail::Tracer<true>::every() {
+    static std::atomic<uint32_t> n {1};
+    return n;
+}
+
+inline void Tracing::setSampleRate(double rate) {
+    if constexpr (enabled) {
+        uint32_t n = rate > 0 ? std::max(1.0, std::round(1 / std::min(rate, 1.0))) : 0;
+        detail::Tracer<true>::every().store(n, std::memory_order_relaxed);
+    }
+}
+
+inline std::vector<Trace> Tracing::recent() {
+    std::vector<Trace> traces;
+    if constexpr (enabled) {
+        for(auto &ring : detail::PerThread<detail::TraceRing>::all()) {
+            ring->collect(traces);
+        }
+        // per ring order is kept, rings are merged by time
+        std::stable_sort(traces.begin(), traces.end(),
+            [](const Trace &lhs, const Trace &rhs) { return lhs.start > rhs.start; });
+    }
+    return traces;
+}
+
+inline std::vector<Trace> Tracing::slow(std::chrono::nanoseconds threshold) {
+    auto traces = recent();
+    uint64_t limit = std::max<int64_t>(0, threshold.count());
+    traces.erase(std::remove_if(traces.begin(), traces.end(),
+        [limit](const Trace &trace) { return trace.total() <= limit; }), traces.end());
+    std::stable_sort(traces.begin(), traces.end(),
+        [](const Trace &lhs, const Trace &rhs) { return lhs.total() > rhs.total(); });
+    return traces;
+}
+
+inline vsjson::Json Tracing::report(std::chrono::nanoseconds threshold) {
+    auto micros = [](uint64_t nanoseconds) { return nanoseconds / 1000.0; };
+    vsjson::Json traces = vsjson::Json::array();
+    for(auto &trace : slow(threshold)) {
+        vsjson::Json stages;
+        for(size_t stage = 0; stage < Trace::STAGES; ++stage) {
+            stages[Trace::stageName(Trace::Stage(stage))] = micros(trace.elapsed[stage]);
+        }
+        vsjson::Json json {
+            {"method", std::string(trace.method)},
+            {"peer", trace.peer.toString()},
+            {"error", trace.error},
+            {"total", micros(trace.total())},
+            {"stages", std::move(stages)},
+        };
+        if(detail::Allocations::counting()) {
+            json["allocations"] = trace.allocations;
+        }
+        traces.append(std::move(json));
+    }
+    return traces;
+}
+
+} // trpc
@@ -0,0 +1,309 @@
+#pragma once
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "co.hpp"
+namespace trpc {
+namespace detail {
+
+// server side admission control (load shedding)
+//
+// - connections over the limit are closed at once
+// - requests over the in-flight limit wait in a queue,
+//   the queue is controlled by CoDel: if even the shortest queueing delay
+//   in the last `interval` is above `target`, the queue is standing (overloaded),
+//   then it is served LIFO and a request waiting longer than `target` is rejected,
+//   or else a request may wait up to `interval`
+//   (checked when a slot is released, and by a timer while no slot is)
+// - adaptive: the in-flight limit itself is adjusted by latency (AIMD),
+//   it backs off when latency grows far beyond the best one recently seen
+//
+// a rejected request gets a fast error instead of a slow timeout
+class Admission {
+public:
+    using Clock = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+
+    constexpr static size_t UNLIMITED = -1;
+
+    struct Limits {
+        // concurrent connections
+        size_t                    connections {UNLIMITED};
+        // requests in flight over all connections
+        size_t                    requests {UNLIMITED};
+        // requests waiting for a slot, more are rejected at once
+        size_t                    queue {UNLIMITED};
+        // CoDel
+        std::chrono::milliseconds target {5};
+        std::chrono::milliseconds interval {100};
+        // adjust the in-flight limit in [1, requests], starting from `initial`
+        bool                      adaptive {false};
+        size_t                    initial {16};
+    };
+
+    // in-flight slot, released on destruction
+    class Ticket;
+
+public:
+    Admission() = default;
+    explicit Admission(Limits limits) { reset(limits); }
+    ~Admission() { if(_timer) _timer->closed = true; }
+
+    void reset(Limits limits);
+
+    // false if too many connections
+    bool connect();
+    void disconnect() { _connections--; }
+
+    // wait (yield) for a slot if necessary
+    // nullopt if rejected, by the queue or `deadline`
+    std::optional<Ticket> admit(TimePoint deadline);
+
+    size_t connections() const { return _connections; }
+    size_t inflight() const { return _inflight; }
+    size_t queued() const { return _queue.size(); }
+    size_t limit() const { return _limits.adaptive ? _adaptiveLimit : _limits.requests; }
+    bool overloaded() const { return _overloaded; }
+
+private:
+
+    struct Waiter {
+        enum State { WAITING, GRANTED, REJECTED };
+
+        std::shared_ptr<co::Coroutine> coroutine;
+        TimePoint                      since;
+        TimePoint                      deadline;
+        State                          state {WAITING};
+    };
+
+    // shared by an admission and its timer coroutine,
+    // the timer may be asleep when the admission is gone
+    struct Timer {
+        bool closed {};
+        bool running {};
+    };
+
+    // nothing to control, no bookkeeping
+    bool unlimited() const { return _limits.requests == UNLIMITED && !_limits.adaptive; }
+
+    void release(TimePoint start);
+
+    // grant free slots to waiters, or reject them
+    void dispatch();
+
+    // waited longer than CoDel allows, or out of its deadline
+    bool late(const Waiter &waiter, TimePoint now) const;
+
+    // when the first queued waiter is late
+    TimePoint nextLate() const;
+
+    // reject the late waiters without a slot released
+    void expire();
+
+    // start the timer (if not running), it runs until the queue is empty
+    void startTimer();
+
+    // queueing delay of an admitted request
+    void observe(Clock::duration delay, TimePoint now);
+
+    // AIMD
+    void adapt(Clock::duration latency, TimePoint now);
+
+private:
+    Limits                              _limits;
+    size_t                              _connections {};
+    size_t                              _inflight {};
+    std::deque<std::shared_ptr<Waiter>> _queue;
+    // created on the first wait
+    std::shared_ptr<Timer>              _timer;
+
+    // CoDel
+    bool                                _overloaded {};
+    Clock::duration                     _minDelay {Clock::duration::max()};
+    TimePoint                           _window {};
+
+    // adaptive limit
+    size_t                              _adaptiveLimit {};
+    // the best latency of the last window and this one
+    Clock::duration                     _lastMinLatency {Clock::duration::max()};
+    Clock::duration                     _minLatency {Clock::duration::max()};
+    TimePoint                           _latencyWindow {};
+    TimePoint                           _nextDecrease {};
+};
+
+class Admission::Ticket {
+public:
+    Ticket(Ticket &&rhs): _admission(rhs._admission), _start(rhs._start) { rhs._admission = nullptr; }
+    Ticket& operator=(Ticket&&) = delete;
+    ~Ticket() { if(_admission) _admission->release(_start); }
+
+private:
+    friend class Admission;
+    Ticket(Admission *admission, TimePoint start): _admission(admission), _start(start) {}
+
+private:
+    Admission *_admission;
+    TimePoint  _start;
+};
+
+inline void Admission::reset(Limits limits) {
+    _limits = limits;
+    _limits.requests = std::max<size_t>(1, _limits.requests);
+    _adaptiveLimit = std::clamp<size_t>(_limits.initial, 1, _limits.requests);
+}
+
+inline bool Admission::connect() {
+    if(_connections >= _limits.connections) return false;
+    _connections++;
+    return true;
+}
+
+inline std::optional<Admission::Ticket> Admission::admit(TimePoint deadline) {
+    if(unlimited()) {
+        return Ticket(nullptr, {});
+    }
+    auto now = Clock::now();
+    if(_inflight < limit() && _queue.empty()) {
+        _inflight++;
+        observe(Clock::duration::zero(), now);
+        return Ticket(this, now);
+    }
+    if(_queue.size() >= _limits.queue || !co::test()) {
+        return std::nullopt;
+    }
+    auto waiter = std::make_shared<Waiter>();
+    waiter->coroutine = co::Coroutine::current().shared_from_this();
+    waiter->since = now;
+    waiter->deadline = deadline;
+    _queue.emplace_back(waiter);
+    startTimer();
+    // resumed by dispatch() or expire()
+    while(waiter->state == Waiter::WAITING) {
+        co::this_coroutine::yield();
+    }
+    if(waiter->state == Waiter::REJECTED) {
+        return std::nullopt;
+    }
+    return Ticket(this, Clock::now());
+}
+
+inline void Admission::release(TimePoint start) {
+    _inflight--;
+    auto now = Clock::now();
+    if(_limits.adaptive) adapt(now - start, now);
+    dispatch();
+}
+
+inline void Admission::dispatch() {
+    while(!_queue.empty() && _inflight < limit()) {
+        auto now = Clock::now();
+        std::shared_ptr<Waiter> waiter;
+        // a standing queue: the newest one is most likely still in time
+        if(_overloaded) {
+            waiter = std::move(_queue.back());
+            _queue.pop_back();
+        } else {
+            waiter = std::move(_queue.front());
+            _queue.pop_front();
+        }
+        if(late(*waiter, now)) {
+            waiter->state = Waiter::REJECTED;
+        } else {
+            waiter->state = Waiter::GRANTED;
+            _inflight++;
+            observe(now - waiter->since, now);
+        }
+        waiter->coroutine->resume();
+    }
+}
+
+inline bool Admission::late(const Waiter &waiter, TimePoint now) const {
+    auto allowed = _overloaded ? _limits.target : _limits.interval;
+    return now - waiter.since > allowed || waiter.deadline <= now;
+}
+
+inline Admission::TimePoint Admission::nextLate() const {
+    auto allowed = _overloaded ? _limits.target : _limits.interval;
+    auto next = TimePoint::max();
+    for(auto &waiter : _queue) {
+        next = std::min({next, waiter->since + allowed, waiter->deadline});
+    }
+    return next;
+}
+
+inline void Admission::expire() {
+    auto now = Clock::now();
+    std::vector<std::shared_ptr<Waiter>> expired;
+    for(auto iter = _queue.begin(); iter != _queue.end();) {
+        if(late(**iter, now)) {
+            expired.emplace_back(std::move(*iter));
+            iter = _queue.erase(iter);
+        } else {
+            ++iter;
+        }
+    }
+    for(auto &waiter : expired) {
+        // no slot is released, but the queue is still standing
+        observe(now - waiter->since, now);
+        waiter->state = Waiter::REJECTED;
+    }
+    // nothing of this admission is touched after a resume
+    for(auto &waiter : expired) {
+        waiter->coroutine->resume();
+    }
+}
+
+inline void Admission::startTimer() {
+    if(!_timer) _timer = std::make_shared<Timer>();
+    if(_timer->running) return;
+    _timer->running = true;
+    co::open().createCoroutine([this, timer = _timer] {
+        using namespace std::chrono;
+        // co::usleep() is less than a second
+        constexpr microseconds MAX_SLEEP = seconds {1} - microseconds {1};
+        while(!timer->closed && !_queue.empty()) {
+            // it always sleeps first, the waiter that starts it is not yielded yet
+            auto wait = ceil<microseconds>(nextLate() - Clock::now());
+            co::usleep(std::clamp(wait, microseconds {1}, MAX_SLEEP).count());
+            if(timer->closed) break;
+            expire();
+        }
+        timer->running = false;
+    })->resume();
+}
+
+inline void Admission::observe(Clock::duration delay, TimePoint now) {
+    _minDelay = std::min(_minDelay, delay);
+    if(now >= _window) {
+        _overloaded = _minDelay > _limits.target;
+        _minDelay = Clock::duration::max();
+        _window = now + _limits.interval;
+    }
+}
+
+inline void Admission::adapt(Clock::duration latency, TimePoint now) {
+    if(now >= _latencyWindow) {
+        _lastMinLatency = _minLatency;
+        _minLatency = Clock::duration::max();
+        _latencyWindow = now + 10 * _limits.interval;
+    }
+    _minLatency = std::min(_minLatency, latency);
+    auto best = std::min(_lastMinLatency, _minLatency);
+    if(latency > 2 * best) {
+        // multiplicative decrease, at most once per interval
+        if(now >= _nextDecrease) {
+            _adaptiveLimit = std::max<size_t>(1, _adaptiveLimit * 9 / 10);
+            _nextDecrease = now + _limits.interval;
+        }
+    } else if(_inflight + 1 >= _adaptiveLimit || !_queue.empty()) {
+        // additive increase, only when the limit is reached
+        _adaptiveLimit = std::min(_adaptiveLimit + 1, _limits.requests);
+    }
+}
+
+} // detail
+} // trpc
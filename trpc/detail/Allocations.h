@@ -0,0 +1,104 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+namespace trpc {
+namespace detail {
+
+// heap allocations made by current thread
+//
+// counted only if the program defines TRPC_COUNT_ALLOCATIONS
+// before including this header in exactly one translation unit
+// (it replaces the global operator new / delete), otherwise they stay 0
+//
+// a request is charged with the allocations of its thread while it runs,
+// so the requests interleaved with a blocking handler share their counts
+struct Allocations {
+    uint64_t count;
+    uint64_t bytes;
+
+    static Allocations& local();
+
+    // whether the counting operator new is linked in, see TRPC_COUNT_ALLOCATIONS
+    static bool& counting();
+};
+
+inline Allocations& Allocations::local() {
+    // constant initialized, safe to use in operator new
+    static thread_local Allocations allocations {};
+    return allocations;
+}
+
+inline bool& Allocations::counting() {
+    static bool counting = false;
+    return counting;
+}
+
+} // detail
+} // trpc
+
+#ifdef TRPC_COUNT_ALLOCATIONS
+
+namespace trpc {
+namespace detail {
+
+inline void* countedAllocate(size_t size, size_t alignment) {
+    auto &allocations = Allocations::local();
+    allocations.count++;
+    allocations.bytes += size;
+    if(size == 0) size = 1;
+    void *p = alignment > alignof(std::max_align_t)
+        ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+        : std::malloc(size);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+// set before main(), the counters of earlier allocations are meaningless anyway
+// (not inline, an unused inline variable may never be initialized)
+static const bool countingAllocations = (Allocations::counting() = true);
+
+} // detail
+} // trpc
+
+// every form is replaced, a runtime (e.g. a sanitizer) may not forward them to the plain one
+void* operator new(size_t size) {
+    return trpc::detail::countedAllocate(size, alignof(std::max_align_t));
+}
+void* operator new[](size_t size) {
+    return trpc::detail::countedAllocate(size, alignof(std::max_align_t));
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+    return trpc::detail::countedAllocate(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return trpc::detail::countedAllocate(size, static_cast<size_t>(alignment));
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try { return operator new(size); } catch(...) { return nullptr; }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try { return operator new[](size); } catch(...) { return nullptr; }
+}
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    try { return operator new(size, alignment); } catch(...) { return nullptr; }
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    try { return operator new[](size, alignment); } catch(...) { return nullptr; }
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+
+#endif
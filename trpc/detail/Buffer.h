@@ -0,0 +1,99 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+namespace trpc {
+namespace detail {
+
+// per-connection read buffer
+//
+//   [consumed][readable: data(), size()][writable: writable()]
+//
+// bytes read ahead (e.g. the rest of a timed out frame, or pipelined frames)
+// are kept for the next read
+//
+// the json parser stops only at '\0', so a frame is terminated before it is parsed,
+// see terminate()
+class Buffer {
+public:
+    explicit Buffer(size_t capacity = INITIAL_CAPACITY): _buf(capacity) {}
+
+    char* data() { return _buf.data() + _begin; }
+    size_t size() const { return _end - _begin; }
+
+    // drop the first `n` readable bytes, undo terminate()
+    void consume(size_t n);
+
+    // the first `n` readable bytes as a C string, until the next consume()
+    // the byte after them (read ahead, or unused) is kept aside meanwhile
+    const char* terminate(size_t n);
+
+    // make room for at least `n` more bytes, then write to [end(), end() + writable())
+    char* reserve(size_t n);
+    char* end() { return _buf.data() + _end; }
+    size_t writable() const { return _buf.size() - _end; }
+    void commit(size_t n) { _end += n; }
+
+    void clear() { _begin = _end = 0; _terminated = NONE; }
+
+public:
+    // 16KiB
+    constexpr static size_t INITIAL_CAPACITY = 1 << 14;
+
+private:
+    // put back the byte of terminate()
+    void restore();
+
+private:
+    constexpr static size_t NONE = -1;
+
+    std::vector<char> _buf;
+    size_t            _begin {};
+    size_t            _end {};
+    // where terminate() wrote '\0', and the byte which was there
+    size_t            _terminated {NONE};
+    char              _saved {};
+};
+
+inline void Buffer::consume(size_t n) {
+    restore();
+    _begin += std::min(n, size());
+    if(_begin == _end) clear();
+}
+
+inline const char* Buffer::terminate(size_t n) {
+    restore();
+    n = std::min(n, size());
+    // room for '\0' after a frame at the very end
+    if(_begin + n == _buf.size()) reserve(1);
+    _terminated = _begin + n;
+    _saved = _buf[_terminated];
+    _buf[_terminated] = '\0';
+    return data();
+}
+
+inline void Buffer::restore() {
+    if(_terminated == NONE) return;
+    _buf[_terminated] = _saved;
+    _terminated = NONE;
+}
+
+inline char* Buffer::reserve(size_t n) {
+    restore();
+    if(writable() >= n) return end();
+    size_t readable = size();
+    // compact first, grow if still not enough
+    if(_begin > 0) {
+        ::memmove(_buf.data(), data(), readable);
+        _begin = 0;
+        _end = readable;
+    }
+    if(writable() < n) {
+        _buf.resize(std::max(_buf.size() * 2, readable + n));
+    }
+    return end();
+}
+
+} // detail
+} // trpc
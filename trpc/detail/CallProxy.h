@@ -2,6 +2,7 @@
 #include "vsjson.hpp"
 #include "FunctionTraits.h"
 #include "protocol.h"
+#include "Params.h"
 namespace trpc {
 namespace detail {
 
@@ -10,18 +11,19 @@ class CallProxy final {
 public:
     CallProxy(F func): _func(std::move(func)) {}
 
-    vsjson::Json operator()(vsjson::Json json) { return dispatch(json); }
+    vsjson::Json operator()(Params &params) { return dispatch(params); }
 
 private:
 
     template <typename WrappedRet = std::conditional_t<
         std::is_same<typename FunctionTraits<F>::ReturnType, void>::value,
             nullptr_t, typename FunctionTraits<F>::ReturnType>>
-    WrappedRet dispatch(vsjson::Json &args) {
+    WrappedRet dispatch(Params &args) {
         using Ret = typename FunctionTraits<F>::ReturnType;
         using ArgsTuple = typename FunctionTraits<F>::ArgsTuple;
         constexpr size_t N = FunctionTraits<F>::ArgsSize;
-        if(N != args.arraySize()) {
+        // checked before any element is parsed
+        if(N != args.size()) {
             throw protocol::Exception::makeInvalidParamsException();
         }
         ArgsTuple argsTuple = make<ArgsTuple>(args, std::make_index_sequence<N>{});
@@ -30,16 +32,16 @@ private:
     }
 
     template <typename Tuple, size_t ...Is>
-    Tuple make(vsjson::Json &json, std::index_sequence<Is...>) {
+    Tuple make(Params &params, std::index_sequence<Is...>) {
         Tuple tuple;
-        std::initializer_list<int> { (get<Tuple, Is>(json, tuple), 0)... };
+        std::initializer_list<int> { (get<Tuple, Is>(params, tuple), 0)... };
         return tuple;
     }
 
     template <typename Tuple, size_t I>
-    void get(vsjson::Json &from, Tuple &to) {
+    void get(Params &from, Tuple &to) {
         using ElemType = std::decay_t<decltype(std::get<I>(to))>;
-        std::get<I>(to) = std::move(from[I]).to<ElemType>();
+        std::get<I>(to) = from.get<ElemType>(I);
     }
 
     template <typename Ret, typename Tuple,
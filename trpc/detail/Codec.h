@@ -1,6 +1,8 @@
 #pragma once
 #include <netinet/in.h>
 #include <cstddef>
+#include <cstring>
+#include <chrono>
 #include "vsjson.hpp"
 #include "protocol.h"
 namespace trpc {
@@ -27,18 +29,58 @@ public:
 
     bool verify(const char *buf, size_t N) const;
 
-    vsjson::Json decode(const char *buf, size_t N) const;
+    // `resource` is forwarded to parser, nullptr means global heap
+    // strings may refer to `buf` directly (zero-copy), so `buf` must outlive the result
+    vsjson::Json decode(const char *buf, size_t N, vsjson::Resource *resource = nullptr) const;
+
+    // json text of the frame, see vsjson::LazyObject for lazy decode
+    const char* content(const char *buf) const { return buf + sizeof(Header); }
+
+    // JSON-RPC batch: an array of requests
+    bool isBatch(const char *buf, size_t N) const;
 
     std::tuple<std::string, Header, Header> dump(vsjson::Json &response) const;
 
+    // the text is written to `buffer` (cleared first) and its capacity is reused
+    // return (length, big endian length)
+    std::tuple<Header, Header> dump(vsjson::Json &response, std::string &buffer) const;
+
+    // a whole frame (header and text) is appended to `buffer`, after the frames already in it
+    // return the length of text
+    Header dumpFrame(vsjson::Json &response, std::string &buffer) const;
+
 // protocol
 public:
 
     void reportError(vsjson::Json &response, const protocol::Exception &e) const;
 
-    std::tuple<std::string, vsjson::Json> prepareNetCall(vsjson::Json request) const;
+    // method is a name (string json) or a method id (integer json)
+    std::tuple<vsjson::Json, vsjson::Json> prepareNetCall(vsjson::Json request) const;
+
+    // lazy version, params are left unparsed
+    // a method name is usually a view into the request frame
+    std::tuple<vsjson::Json, vsjson::LazyArray> prepareNetCall(const vsjson::LazyObject &request,
+                                                               vsjson::Resource *resource) const;
 
     void fillResultToResponse(vsjson::Json &response, vsjson::Json result) const;
+
+// deadline
+public:
+
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    // clocks are not shared between hosts, so the remaining budget is sent
+    // instead of the deadline itself, nothing is sent for TimePoint::max()
+    void fillDeadlineToRequest(vsjson::Json &request, TimePoint deadline) const;
+
+    // deadline of a request received at `arrival`, TimePoint::max() if not limited
+    TimePoint deadline(const vsjson::LazyObject &request, TimePoint arrival,
+                       vsjson::Resource *resource) const;
+    TimePoint deadline(vsjson::Json &request, TimePoint arrival) const;
+
+private:
+
+    TimePoint deadlineAfter(const vsjson::Json &timeout, TimePoint arrival) const;
 };
 
 inline std::tuple<bool, Codec::Header> Codec::contentLength(const char *buf, size_t N) const {
@@ -53,8 +95,13 @@ inline bool Codec::verify(const char *buf, size_t N) const {
     return succ && N >= sizeof(uint32_t) + length;
 }
 
-inline vsjson::Json Codec::decode(const char *buf, size_t N) const {
-    return vsjson::parse(buf + sizeof(uint32_t));
+inline vsjson::Json Codec::decode(const char *buf, size_t N, vsjson::Resource *resource) const {
+    return vsjson::parseView(buf + sizeof(uint32_t), resource);
+}
+
+inline bool Codec::isBatch(const char *buf, size_t N) const {
+    auto p = vsjson::parser::skipWhitespace(content(buf));
+    return p < buf + N && *p == '[';
 }
 
 inline void Codec::reportError(vsjson::Json &response, const protocol::Exception &e) const {
@@ -79,16 +126,79 @@ Codec::dump(vsjson::Json &response) const {
     return {std::move(dump), responseLength, responseLengthBeLength};
 }
 
+inline std::tuple<Codec::Header, Codec::Header>
+Codec::dump(vsjson::Json &response, std::string &buffer) const {
+    buffer.clear();
+    response.dumpTo(buffer);
+    Header responseLength = buffer.length();
+    return {responseLength, ::htonl(responseLength)};
+}
 
-inline std::tuple<std::string, vsjson::Json> Codec::prepareNetCall(vsjson::Json request) const {
-    auto method = std::move(request[detail::protocol::Field::method]).to<std::string>();
+inline Codec::Header Codec::dumpFrame(vsjson::Json &response, std::string &buffer) const {
+    size_t offset = buffer.size();
+    // filled later
+    buffer.append(sizeof(Header), '\0');
+    response.dumpTo(buffer);
+    Header length = buffer.size() - offset - sizeof(Header);
+    Header beLength = ::htonl(length);
+    ::memcpy(&buffer[offset], &beLength, sizeof beLength);
+    return length;
+}
+
+inline std::tuple<vsjson::Json, vsjson::Json> Codec::prepareNetCall(vsjson::Json request) const {
+    auto method = std::move(request[detail::protocol::Field::method]);
     auto args = std::move(request[detail::protocol::Field::params]);
     return std::make_tuple(std::move(method), std::move(args));
 }
 
+inline std::tuple<vsjson::Json, vsjson::LazyArray>
+Codec::prepareNetCall(const vsjson::LazyObject &request, vsjson::Resource *resource) const {
+    auto method = request.find(detail::protocol::Field::method);
+    if(!method || !(method->isString() || method->isNumber())) {
+        throw protocol::Exception::makeInvalidRequestException();
+    }
+    auto params = request.find(detail::protocol::Field::params);
+    if(!params) {
+        return std::make_tuple(method->parse(resource), vsjson::LazyArray());
+    }
+    if(!params->isArray()) {
+        throw protocol::Exception::makeInvalidParamsException();
+    }
+    return std::make_tuple(method->parse(resource), vsjson::LazyArray(params->begin));
+}
+
 inline void Codec::fillResultToResponse(vsjson::Json &response, vsjson::Json result) const {
     response[detail::protocol::Field::result] = std::move(result);
 }
 
+inline void Codec::fillDeadlineToRequest(vsjson::Json &request, TimePoint deadline) const {
+    if(deadline == TimePoint::max()) return;
+    auto remain = std::chrono::ceil<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now()).count();
+    request[protocol::Field::timeout] = static_cast<int64_t>(std::max<decltype(remain)>(remain, 0));
+}
+
+inline Codec::TimePoint Codec::deadline(const vsjson::LazyObject &request, TimePoint arrival,
+                                        vsjson::Resource *resource) const {
+    auto timeout = request.find(protocol::Field::timeout);
+    if(!timeout) return TimePoint::max();
+    return deadlineAfter(timeout->parse(resource), arrival);
+}
+
+inline Codec::TimePoint Codec::deadline(vsjson::Json &request, TimePoint arrival) const {
+    if(!request.contains(protocol::Field::timeout)) return TimePoint::max();
+    return deadlineAfter(request[protocol::Field::timeout], arrival);
+}
+
+inline Codec::TimePoint Codec::deadlineAfter(const vsjson::Json &timeout, TimePoint arrival) const {
+    if(!timeout.is<vsjson::IntegerImpl>()) {
+        throw protocol::Exception::makeInvalidRequestException();
+    }
+    std::chrono::milliseconds remain {timeout.to<int64_t>()};
+    // not limited in practice, and arrival + remain may overflow
+    if(remain >= std::chrono::hours {1<<9}) return TimePoint::max();
+    return arrival + remain;
+}
+
 } // detail
 } // trpc
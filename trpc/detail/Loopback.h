@@ -0,0 +1,379 @@
+#pragma once
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include "co.hpp"
+#include "vsjson.hpp"
+namespace trpc {
+namespace detail {
+
+// wakes a coroutine waiting for a condition guarded by a mutex
+//
+// the waiter of the same thread as its notifier yields, and is resumed by the notifier,
+// or else it sleeps on an eventfd in co::poll (with a deadline)
+class Signal {
+public:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    // wait once, the condition should be checked again then
+    // `resumable`: the notifier is a coroutine of this thread, and the deadline is ignored
+    // false if timed out
+    bool wait(std::unique_lock<std::mutex> &lock, TimePoint deadline, bool resumable);
+
+    // the condition may be true now, `lock` is released
+    void notify(std::unique_lock<std::mutex> &lock);
+
+    Signal() = default;
+    Signal(const Signal&) = delete;
+    ~Signal() { if(_eventfd >= 0) ::close(_eventfd); }
+
+private:
+    // yielded
+    std::shared_ptr<co::Coroutine> _waiter;
+    // created by the first sleeper
+    int                            _eventfd {-1};
+    bool                           _sleeping {};
+};
+
+// one end of an in-memory connection between two coroutines of this process
+// the same interface as detail::SocketStream
+class PipeStream {
+public:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    // client end and server end, the server end is served by a coroutine of `server`
+    static std::pair<std::shared_ptr<PipeStream>, std::shared_ptr<PipeStream>> make(std::thread::id server);
+
+    ssize_t read(void *buf, size_t least, size_t most, TimePoint deadline);
+    ssize_t write(const void *buf, size_t size, TimePoint deadline);
+    bool pending(TimePoint deadline);
+    bool readable();
+
+    // the peer runs in this thread
+    bool local() const { return _local; }
+
+    // the peer reads FIN after what is written, and writes nothing more
+    // (and so does a reader of mine asleep in another coroutine)
+    void close();
+
+    ~PipeStream() { close(); }
+
+private:
+    struct Queue {
+        std::string bytes;
+        size_t      offset {};
+        bool        closed {};
+        // of the reader
+        Signal      signal;
+    };
+
+    struct Shared {
+        std::mutex mutex;
+        // 0: client -> server, 1: server -> client
+        Queue      queues[2];
+    };
+
+    PipeStream(std::shared_ptr<Shared> shared, bool server, bool local);
+
+    // a local server never times out, it is resumed when the client writes or closes
+    bool resumable(TimePoint deadline) const;
+
+private:
+    std::shared_ptr<Shared> _shared;
+    // I read _in, and write _out
+    Queue                  *_in;
+    Queue                  *_out;
+    bool                    _server;
+    bool                    _local;
+    bool                    _closed {};
+};
+
+// a Server reachable by name in this process, see Endpoint "inproc://name"
+class Loopback {
+public:
+    // called in the thread of server
+    // nullopt if nothing to reply
+    using Respond = std::function<std::optional<vsjson::Json>(vsjson::Json &request)>;
+
+    // taken by a Server, nullptr if the name is in use (EADDRINUSE)
+    static std::shared_ptr<Loopback> bind(std::string_view name);
+
+    // nullptr if no server listens on it (ECONNREFUSED)
+    static std::shared_ptr<Loopback> find(std::string_view name);
+
+    // server: accept connections in the current thread
+    // `respond` serves a request without serialization, see Client::skipSerialization()
+    void listen(Respond respond);
+
+    // server: wait for a connection, nullptr if closed
+    std::shared_ptr<PipeStream> accept();
+
+    // server: the name is released, accept() returns nullptr
+    void close();
+
+    // client: nullptr if not listening (ECONNREFUSED)
+    std::shared_ptr<PipeStream> connect();
+
+    // client: serve a request in this thread, the server must be local
+    std::optional<vsjson::Json> respond(vsjson::Json &request);
+
+    explicit Loopback(std::string name): _name(std::move(name)) {}
+    Loopback(const Loopback&) = delete;
+
+private:
+    using Registry = std::unordered_map<std::string, std::weak_ptr<Loopback>>;
+
+    static Registry& registry();
+    static std::mutex& registryMutex();
+
+private:
+    std::string                              _name;
+    std::mutex                               _mutex;
+    std::thread::id                          _thread;
+    bool                                     _listening {};
+    bool                                     _closed {};
+    std::deque<std::shared_ptr<PipeStream>>  _backlog;
+    Signal                                   _signal;
+    Respond                                  _respond;
+};
+
+inline bool Signal::wait(std::unique_lock<std::mutex> &lock, TimePoint deadline, bool resumable) {
+    if(resumable) {
+        _waiter = co::Coroutine::current().shared_from_this();
+        lock.unlock();
+        // resumed by notify()
+        co::this_coroutine::yield();
+        lock.lock();
+        return true;
+    }
+    auto remain = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if(remain <= 0) {
+        return false;
+    }
+    if(_eventfd < 0) {
+        _eventfd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(_eventfd < 0) return false;
+    }
+    int fd = _eventfd;
+    _sleeping = true;
+    lock.unlock();
+    pollfd pfd {fd, POLLIN, 0};
+    co::poll(&pfd, 1, std::min<decltype(remain)>(remain, INT_MAX));
+    lock.lock();
+    _sleeping = false;
+    uint64_t count;
+    ssize_t _ = ::read(fd, &count, sizeof count);
+    (void)_;
+    return true;
+}
+
+inline void Signal::notify(std::unique_lock<std::mutex> &lock) {
+    if(auto waiter = std::move(_waiter)) {
+        lock.unlock();
+        waiter->resume();
+        return;
+    }
+    if(_sleeping) {
+        uint64_t one = 1;
+        ssize_t _ = ::write(_eventfd, &one, sizeof one);
+        (void)_;
+    }
+    lock.unlock();
+}
+
+inline std::pair<std::shared_ptr<PipeStream>, std::shared_ptr<PipeStream>> PipeStream::make(std::thread::id server) {
+    auto shared = std::make_shared<Shared>();
+    bool local = server == std::this_thread::get_id();
+    return {std::shared_ptr<PipeStream>(new PipeStream(shared, false, local)),
+            std::shared_ptr<PipeStream>(new PipeStream(shared, true, local))};
+}
+
+inline PipeStream::PipeStream(std::shared_ptr<Shared> shared, bool server, bool local)
+    : _shared(std::move(shared)),
+      _in(&_shared->queues[!server]),
+      _out(&_shared->queues[server]),
+      _server(server),
+      _local(local)
+{}
+
+inline bool PipeStream::resumable(TimePoint deadline) const {
+    return _local && (_server || deadline == TimePoint::max());
+}
+
+inline ssize_t PipeStream::read(void *buf, size_t least, size_t most, TimePoint deadline) {
+    std::unique_lock<std::mutex> lock {_shared->mutex};
+    size_t offset = 0;
+    while(offset < least) {
+        size_t available = _in->bytes.size() - _in->offset;
+        if(available == 0) {
+            if(_in->closed) {
+                // FIN
+                errno = 0;
+                return offset;
+            }
+            if(!_in->signal.wait(lock, deadline, resumable(deadline))) break;
+            continue;
+        }
+        size_t n = std::min(available, most - offset);
+        ::memcpy(static_cast<char*>(buf) + offset, _in->bytes.data() + _in->offset, n);
+        _in->offset += n;
+        offset += n;
+        // drained, reuse the capacity
+        if(_in->offset == _in->bytes.size()) {
+            _in->bytes.clear();
+            _in->offset = 0;
+        }
+    }
+    if(offset >= least) return offset;
+    errno = ETIMEDOUT;
+    return offset == 0 ? -1 : offset;
+}
+
+inline ssize_t PipeStream::write(const void *buf, size_t size, TimePoint) {
+    std::unique_lock<std::mutex> lock {_shared->mutex};
+    // closed by peer (or by me)
+    if(_out->closed) {
+        errno = EPIPE;
+        return -1;
+    }
+    // unbounded, memory is the only limit
+    _out->bytes.append(static_cast<const char*>(buf), size);
+    _out->signal.notify(lock);
+    return size;
+}
+
+inline bool PipeStream::pending(TimePoint deadline) {
+    std::unique_lock<std::mutex> lock {_shared->mutex};
+    while(_in->bytes.size() == _in->offset && !_in->closed) {
+        if(!_in->signal.wait(lock, deadline, resumable(deadline))) {
+            errno = ETIMEDOUT;
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool PipeStream::readable() {
+    std::lock_guard<std::mutex> _ {_shared->mutex};
+    return _in->bytes.size() != _in->offset || _in->closed;
+}
+
+inline void PipeStream::close() {
+    if(_closed) return;
+    _closed = true;
+    // keep alive, the peer may release the last reference when resumed
+    auto shared = _shared;
+    std::unique_lock<std::mutex> lock {shared->mutex};
+    _in->closed = true;
+    _out->closed = true;
+    _out->signal.notify(lock);
+    // and a reader of mine in another coroutine
+    lock.lock();
+    _in->signal.notify(lock);
+}
+
+inline std::shared_ptr<Loopback> Loopback::bind(std::string_view name) {
+    std::lock_guard<std::mutex> _ {registryMutex()};
+    auto &weak = registry()[std::string(name)];
+    if(!weak.expired()) {
+        errno = EADDRINUSE;
+        return nullptr;
+    }
+    auto loopback = std::make_shared<Loopback>(std::string(name));
+    weak = loopback;
+    return loopback;
+}
+
+inline std::shared_ptr<Loopback> Loopback::find(std::string_view name) {
+    std::lock_guard<std::mutex> _ {registryMutex()};
+    auto iter = registry().find(std::string(name));
+    auto loopback = iter == registry().end() ? nullptr : iter->second.lock();
+    if(!loopback) errno = ECONNREFUSED;
+    return loopback;
+}
+
+inline void Loopback::listen(Respond respond) {
+    std::lock_guard<std::mutex> _ {_mutex};
+    _thread = std::this_thread::get_id();
+    _respond = std::move(respond);
+    _listening = true;
+}
+
+inline std::shared_ptr<PipeStream> Loopback::accept() {
+    std::unique_lock<std::mutex> lock {_mutex};
+    while(_backlog.empty() && !_closed) {
+        // a client may connect from any thread
+        _signal.wait(lock, std::chrono::steady_clock::time_point::max(), false);
+    }
+    if(_closed) return nullptr;
+    auto stream = std::move(_backlog.front());
+    _backlog.pop_front();
+    return stream;
+}
+
+inline void Loopback::close() {
+    {
+        std::lock_guard<std::mutex> _ {registryMutex()};
+        auto iter = registry().find(_name);
+        if(iter != registry().end() && iter->second.lock().get() == this) {
+            registry().erase(iter);
+        }
+    }
+    std::unique_lock<std::mutex> lock {_mutex};
+    if(_closed) return;
+    _closed = true;
+    _listening = false;
+    _respond = nullptr;
+    // refused
+    _backlog.clear();
+    _signal.notify(lock);
+}
+
+inline std::shared_ptr<PipeStream> Loopback::connect() {
+    std::unique_lock<std::mutex> lock {_mutex};
+    if(!_listening) {
+        errno = ECONNREFUSED;
+        return nullptr;
+    }
+    auto [client, server] = PipeStream::make(_thread);
+    _backlog.emplace_back(std::move(server));
+    _signal.notify(lock);
+    return client;
+}
+
+inline std::optional<vsjson::Json> Loopback::respond(vsjson::Json &request) {
+    // the same thread, and the server cannot be closed meanwhile
+    if(!_respond) {
+        errno = ECONNRESET;
+        return std::nullopt;
+    }
+    return _respond(request);
+}
+
+inline Loopback::Registry& Loopback::registry() {
+    static Registry registry;
+    return registry;
+}
+
+inline std::mutex& Loopback::registryMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+} // detail
+} // trpc
@@ -0,0 +1,186 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "vsjson.hpp"
+#include "CallProxy.h"
+#include "Params.h"
+namespace trpc {
+namespace detail {
+
+// bound function
+// type-erased by a plain function pointer, cheaper than std::function
+class Method {
+public:
+    template <typename F>
+    static Method make(const F &func);
+
+    vsjson::Json operator()(Params &params) const { return _invoke(_proxy.get(), params); }
+
+private:
+    using Invoke = vsjson::Json(*)(void*, Params&);
+    using Deleter = void(*)(void*);
+
+    Method(void *proxy, Invoke invoke, Deleter deleter)
+        : _proxy(proxy, deleter), _invoke(invoke) {}
+
+private:
+    std::unique_ptr<void, Deleter> _proxy;
+    Invoke                         _invoke;
+};
+
+// method name -> Method
+//
+// a flat vector in bind order, lookup is a binary search by default
+// freeze() builds a perfect hash over the current names (hash and displace):
+// names are grouped into buckets, each bucket picks a seed that sends
+// all its names to free slots, then lookup is two hashes plus one string comparison
+//
+// a method id is the position in bind order, it never changes
+// (rebinding a name keeps its id), so it can be handed out to clients
+class MethodTable {
+public:
+    constexpr static size_t NOT_FOUND = -1;
+
+public:
+    // replace the old one if exists, unfreeze the table
+    void bind(std::string name, Method method);
+
+    void freeze();
+    bool frozen() const { return !_slots.empty() || _entries.empty(); }
+
+    size_t id(std::string_view name) const;
+
+    // nullptr if not found
+    const Method* find(std::string_view name) const;
+    const Method* find(size_t id) const { return id < _entries.size() ? &_entries[id].second : nullptr; }
+
+    const std::string& name(size_t id) const { return _entries[id].first; }
+    size_t size() const { return _entries.size(); }
+
+private:
+    using Entry = std::pair<std::string, Method>;
+    using Slot = uint32_t;
+    constexpr static Slot EMPTY_SLOT = -1;
+
+    auto lowerBound(std::string_view name) const;
+
+    // FNV-1a
+    static uint64_t hash(std::string_view name, uint64_t seed);
+    size_t bucket(std::string_view name) const { return hash(name, 0) & (_seeds.size() - 1); }
+    size_t probe(std::string_view name, uint64_t seed) const { return hash(name, seed) & (_slots.size() - 1); }
+
+private:
+    std::vector<Entry>    _entries;
+    // entry positions sorted by name
+    std::vector<Slot>     _sorted;
+    // entry position, empty until freeze()
+    std::vector<Slot>     _slots;
+    // per bucket seed
+    std::vector<uint32_t> _seeds;
+};
+
+template <typename F>
+inline Method Method::make(const F &func) {
+    using Proxy = CallProxy<F>;
+    auto invoke = [](void *proxy, Params &params) {
+        return (*static_cast<Proxy*>(proxy))(params);
+    };
+    auto deleter = [](void *proxy) {
+        delete static_cast<Proxy*>(proxy);
+    };
+    return Method(new Proxy(func), invoke, deleter);
+}
+
+inline auto MethodTable::lowerBound(std::string_view name) const {
+    return std::lower_bound(_sorted.begin(), _sorted.end(), name,
+        [this](Slot pos, std::string_view name) { return _entries[pos].first < name; });
+}
+
+inline void MethodTable::bind(std::string name, Method method) {
+    auto iter = lowerBound(name);
+    if(iter != _sorted.end() && _entries[*iter].first == name) {
+        _entries[*iter].second = std::move(method);
+    } else {
+        _sorted.insert(iter, _entries.size());
+        _entries.emplace_back(std::move(name), std::move(method));
+    }
+    _slots.clear();
+    _seeds.clear();
+}
+
+inline void MethodTable::freeze() {
+    if(frozen()) return;
+    size_t buckets = 1, capacity = 2;
+    while(buckets < _entries.size()) buckets <<= 1;
+    // load factor <= 0.5
+    while(capacity < 2 * _entries.size()) capacity <<= 1;
+    _seeds.assign(buckets, 0);
+    _slots.assign(capacity, EMPTY_SLOT);
+
+    std::vector<std::vector<Slot>> groups(buckets);
+    for(Slot pos = 0; pos < _entries.size(); ++pos) {
+        groups[bucket(_entries[pos].first)].push_back(pos);
+    }
+    // larger buckets first, while there are more free slots
+    std::vector<size_t> order(buckets);
+    for(size_t i = 0; i < buckets; ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+        [&](size_t lhs, size_t rhs) { return groups[lhs].size() > groups[rhs].size(); });
+
+    std::vector<size_t> taken;
+    for(auto b : order) {
+        auto &group = groups[b];
+        if(group.empty()) break;
+        for(uint32_t seed = 1; ; ++seed) {
+            taken.clear();
+            for(auto pos : group) {
+                size_t slot = probe(_entries[pos].first, seed);
+                if(_slots[slot] != EMPTY_SLOT
+                        || std::find(taken.begin(), taken.end(), slot) != taken.end()) {
+                    break;
+                }
+                taken.emplace_back(slot);
+            }
+            if(taken.size() == group.size()) {
+                for(size_t i = 0; i < group.size(); ++i) _slots[taken[i]] = group[i];
+                _seeds[b] = seed;
+                break;
+            }
+        }
+    }
+}
+
+inline size_t MethodTable::id(std::string_view name) const {
+    if(!_slots.empty()) {
+        Slot pos = _slots[probe(name, _seeds[bucket(name)])];
+        return pos != EMPTY_SLOT && _entries[pos].first == name ? pos : NOT_FOUND;
+    }
+    auto iter = lowerBound(name);
+    if(iter != _sorted.end() && _entries[*iter].first == name) {
+        return *iter;
+    }
+    return NOT_FOUND;
+}
+
+inline const Method* MethodTable::find(std::string_view name) const {
+    size_t pos = id(name);
+    return pos != NOT_FOUND ? &_entries[pos].second : nullptr;
+}
+
+inline uint64_t MethodTable::hash(std::string_view name, uint64_t seed) {
+    uint64_t h = 0xcbf29ce484222325ull ^ (seed * 0x9e3779b97f4a7c15ull);
+    for(unsigned char c : name) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    // fold the high bits, only the low bits are used as slot
+    return h ^ (h >> 29);
+}
+
+} // detail
+} // trpc
@@ -0,0 +1,258 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "../Endpoint.h"
+#include "../Histogram.h"
+#include "Allocations.h"
+#include "PerThread.h"
+namespace trpc {
+namespace detail {
+
+// server side latency of a request is split into phases
+enum Phase {
+    // request text -> method and params (params of lazy mode are parsed by handler)
+    DECODE,
+    // waiting for admission, see detail::Admission
+    QUEUEING,
+    HANDLER,
+    // response -> text (a frame queued to the connection, see detail::Outbound)
+    ENCODE,
+    // always 0 now: queued frames are written after the request is recorded
+    WRITE,
+    PHASES
+};
+
+constexpr const char* phaseName(Phase phase) {
+    constexpr const char *names[] {"decode", "queueing", "handler", "encode", "write"};
+    return names[phase];
+}
+
+// errors by JSON-RPC code
+// at most `SLOTS` distinct codes, the rest are not counted
+class ErrorCounters {
+public:
+    constexpr static size_t SLOTS = 16;
+
+    void add(int code);
+
+    // visit (code, count)
+    template <typename Visitor>
+    void forEach(Visitor &&visitor) const;
+
+private:
+    // 0 means a free slot, a code is published after its count
+    std::array<std::atomic<int>, SLOTS> _codes {};
+    std::array<Counter, SLOTS>          _counts;
+};
+
+struct MethodMetrics;
+
+// phase timestamps of a request (or a batch frame)
+class Sample {
+public:
+    using Clock = std::chrono::steady_clock;
+    using TimePoint = Clock::time_point;
+
+    MethodMetrics        *method {};
+    // JSON-RPC error code, 0 if succeeded
+    int                   error {};
+    size_t                bytesIn {};
+    size_t                bytesOut {};
+    // heap allocations of this thread until finish(), see detail::Allocations
+    uint64_t              allocations {};
+
+public:
+    explicit Sample(TimePoint start = Clock::now())
+        : allocations(Allocations::local().count), _mark(start) {}
+
+    // the current phase ends, time from now on goes to `next`
+    void enter(Phase next);
+    // the last phase ends
+    void finish();
+
+    bool entered(Phase phase) const { return _entered & (1u << phase); }
+    Clock::duration elapsed(Phase phase) const { return _elapsed[phase]; }
+
+private:
+    TimePoint                            _mark;
+    Phase                                _phase {DECODE};
+    unsigned                             _entered {1u << DECODE};
+    std::array<Clock::duration, PHASES> _elapsed {};
+};
+
+struct MethodMetrics {
+    // key of Shard::methods
+    std::string_view                name;
+    Counter                         requests;
+    ErrorCounters                   errors;
+    Counter                         bytesIn;
+    Counter                         bytesOut;
+    Counter                         allocations;
+    std::array<Histogram, PHASES>   latency;
+
+    void record(const Sample &sample);
+};
+
+// a batch frame is one request of a connection
+struct ConnectionMetrics {
+    Endpoint peer;
+    Counter  requests;
+    Counter  errors;
+    Counter  bytesIn;
+    Counter  bytesOut;
+
+    void record(const Sample &sample);
+};
+
+// metrics of one thread
+//
+// only the owner thread writes the counters, without any lock,
+// `mutex` guards the structure (new methods, connections) against readers
+struct Shard {
+    std::mutex                                                      mutex;
+    std::unordered_map<std::string, std::unique_ptr<MethodMetrics>> methods;
+    std::list<ConnectionMetrics>                                    connections;
+
+    // shard of current thread
+    static Shard& local() { return PerThread<Shard>::local(); }
+
+    // all shards, including those of exited threads
+    static std::vector<std::shared_ptr<Shard>> all() { return PerThread<Shard>::all(); }
+
+    // created if not exists
+    MethodMetrics* method(std::string_view name);
+
+    std::list<ConnectionMetrics>::iterator connect(Endpoint peer);
+    void disconnect(std::list<ConnectionMetrics>::iterator connection);
+};
+
+// per-server cache of the MethodMetrics of current thread
+// method ids are dense (see detail::MethodTable), so they index a vector
+class MetricsCache {
+public:
+    // names of pseudo methods
+    constexpr static char UNKNOWN[] {"<unknown>"};
+    constexpr static char BATCH[]   {"<batch>"};
+
+    MethodMetrics* method(size_t id, std::string_view name);
+    // not cached, for rarely used ones (built-in methods)
+    MethodMetrics* method(std::string_view name) { return Shard::local().method(name); }
+
+    MethodMetrics* unknown() { return _unknown ? _unknown : (_unknown = method(UNKNOWN)); }
+    MethodMetrics* batch() { return _batch ? _batch : (_batch = method(BATCH)); }
+
+    // must be reset if the server is moved to another thread
+    void reset();
+
+private:
+    std::vector<MethodMetrics*> _methods;
+    MethodMetrics              *_unknown {};
+    MethodMetrics              *_batch {};
+};
+
+inline void ErrorCounters::add(int code) {
+    for(size_t i = 0; i < SLOTS; ++i) {
+        int slot = _codes[i].load(std::memory_order_relaxed);
+        if(slot == code) {
+            _counts[i].add();
+            return;
+        }
+        if(slot == 0) {
+            _counts[i].add();
+            _codes[i].store(code, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+template <typename Visitor>
+inline void ErrorCounters::forEach(Visitor &&visitor) const {
+    for(size_t i = 0; i < SLOTS; ++i) {
+        int code = _codes[i].load(std::memory_order_acquire);
+        if(code == 0) break;
+        visitor(code, _counts[i].get());
+    }
+}
+
+inline void Sample::enter(Phase next) {
+    auto now = Clock::now();
+    if(_phase != PHASES) _elapsed[_phase] += now - _mark;
+    _mark = now;
+    _phase = next;
+    if(next != PHASES) _entered |= 1u << next;
+}
+
+inline void Sample::finish() {
+    enter(PHASES);
+    allocations = Allocations::local().count - allocations;
+}
+
+inline void MethodMetrics::record(const Sample &sample) {
+    requests.add();
+    if(sample.error) errors.add(sample.error);
+    bytesIn.add(sample.bytesIn);
+    bytesOut.add(sample.bytesOut);
+    allocations.add(sample.allocations);
+    for(size_t phase = 0; phase < PHASES; ++phase) {
+        if(sample.entered(Phase(phase))) {
+            latency[phase].record(sample.elapsed(Phase(phase)));
+        }
+    }
+}
+
+inline void ConnectionMetrics::record(const Sample &sample) {
+    requests.add();
+    if(sample.error) errors.add();
+    bytesIn.add(sample.bytesIn);
+    bytesOut.add(sample.bytesOut);
+}
+
+inline MethodMetrics* Shard::method(std::string_view name) {
+    std::lock_guard<std::mutex> _ {mutex};
+    auto [iter, inserted] = methods.try_emplace(std::string(name));
+    if(inserted) {
+        iter->second = std::make_unique<MethodMetrics>();
+        iter->second->name = iter->first;
+    }
+    return iter->second.get();
+}
+
+inline std::list<ConnectionMetrics>::iterator Shard::connect(Endpoint peer) {
+    std::lock_guard<std::mutex> _ {mutex};
+    connections.emplace_front();
+    connections.front().peer = peer;
+    return connections.begin();
+}
+
+inline void Shard::disconnect(std::list<ConnectionMetrics>::iterator connection) {
+    std::lock_guard<std::mutex> _ {mutex};
+    connections.erase(connection);
+}
+
+inline MethodMetrics* MetricsCache::method(size_t id, std::string_view name) {
+    if(id >= _methods.size()) _methods.resize(id + 1);
+    auto &metrics = _methods[id];
+    if(!metrics) metrics = method(name);
+    return metrics;
+}
+
+inline void MetricsCache::reset() {
+    _methods.clear();
+    _unknown = _batch = nullptr;
+}
+
+constexpr char MetricsCache::UNKNOWN[];
+constexpr char MetricsCache::BATCH[];
+
+} // detail
+} // trpc
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include "vsjson.hpp"
+#include "Codec.h"
+namespace trpc {
+namespace detail {
+
+// responses of a connection waiting to be sent, as frames back to back,
+// so that they are written together (one syscall for a socket)
+//
+// a server corks the responses while more requests are readable (pipelined),
+// and flushes them before it waits for the next request,
+// or once they are over MAX_BYTES, or the first of them is older than MAX_DELAY
+// (a cork timer flushes them even if the connection is busy in a read or a handler, see Cork)
+class Outbound {
+public:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    // corking thresholds
+    constexpr static size_t MAX_BYTES = 1 << 15;
+    constexpr static std::chrono::microseconds MAX_DELAY {200};
+
+    // encode a response after the queued ones
+    // return the size of its frame
+    size_t push(vsjson::Json &response, const Codec &codec, TimePoint now);
+
+    // flush it now, even if more requests are readable
+    bool due(TimePoint now) const;
+
+    // when it is due by age
+    TimePoint deadline() const { return _since + MAX_DELAY; }
+
+    bool empty() const { return _buffer.empty(); }
+
+    // the queued frames are taken to be written, and the queue goes on empty,
+    // so frames pushed during a (yielding) write are not moved under it
+    const std::string& take();
+
+    // the taken frames are written (or failed)
+    void done() { _sending.clear(); _writing = false; }
+
+    // taken, but not done yet
+    bool writing() const { return _writing; }
+
+    // capacity is kept
+    void clear() { _buffer.clear(); _sending.clear(); _writing = false; }
+    size_t capacity() const { return std::max(_buffer.capacity(), _sending.capacity()); }
+    void reserve(size_t size) { _buffer.reserve(size); }
+
+private:
+    std::string _buffer;
+    // being written, swapped with `_buffer` so that both capacities are reused
+    std::string _sending;
+    // when the first frame was queued
+    TimePoint   _since;
+    bool        _writing {};
+};
+
+// shared by a connection and its cork timer,
+// the timer may be asleep when the connection ends
+struct Cork {
+    // the connection is gone, neither the stream nor the queue can be touched
+    bool closed {};
+    // yielded until the connection corks again
+    bool idle {};
+    // a flush of the timer failed
+    bool broken {};
+};
+
+inline size_t Outbound::push(vsjson::Json &response, const Codec &codec, TimePoint now) {
+    if(_buffer.empty()) _since = now;
+    return sizeof(Codec::Header) + codec.dumpFrame(response, _buffer);
+}
+
+inline bool Outbound::due(TimePoint now) const {
+    return _buffer.size() >= MAX_BYTES || now >= deadline();
+}
+
+inline const std::string& Outbound::take() {
+    _sending.clear();
+    _sending.swap(_buffer);
+    _writing = true;
+    return _sending;
+}
+
+} // detail
+} // trpc
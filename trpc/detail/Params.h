@@ -0,0 +1,81 @@
+#pragma once
+#include <cstddef>
+#include <forward_list>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include "vsjson.hpp"
+#include "protocol.h"
+namespace trpc {
+namespace detail {
+
+// arguments of a call
+//
+// eager: a parsed json array
+// lazy:  unparsed elements in the request frame, each one is parsed
+//        only when CallProxy converts it to the argument type
+class Params {
+public:
+    explicit Params(vsjson::Json &array)
+        : _array(&array), _lazy(nullptr), _resource(nullptr) {}
+
+    // `resource` is used by the elements parsed on demand
+    Params(const vsjson::LazyArray &lazy, vsjson::Resource *resource)
+        : _array(nullptr), _lazy(&lazy), _resource(resource) {}
+
+    // throws protocol::Exception if params is neither an array nor omitted
+    size_t size() const;
+
+    // throws protocol::Exception (invalid params) if a number does not fit in T
+    template <typename T>
+    T get(size_t index);
+
+private:
+    template <typename T>
+    T convert(size_t index);
+
+private:
+    vsjson::Json            *_array;
+    const vsjson::LazyArray *_lazy;
+    vsjson::Resource        *_resource;
+    // lazy elements that a std::string_view argument refers to
+    // only needed for strings with escape sequences, others are views into the frame
+    std::forward_list<vsjson::Json> _pinned;
+};
+
+inline size_t Params::size() const {
+    if(_lazy) return _lazy->size();
+    // params may be omitted
+    if(_array->is<vsjson::NullImpl>()) return 0;
+    if(!_array->is<vsjson::ArrayImpl>()) {
+        throw protocol::Exception::makeInvalidParamsException();
+    }
+    return _array->arraySize();
+}
+
+template <typename T>
+inline T Params::get(size_t index) {
+    try {
+        return convert<T>(index);
+    } catch(const std::out_of_range &e) {
+        throw protocol::Exception::makeInvalidParamsException();
+    }
+}
+
+template <typename T>
+inline T Params::convert(size_t index) {
+    if(_lazy) {
+        auto &raw = (*_lazy)[index];
+        if constexpr (std::is_same<T, std::string_view>::value) {
+            if(raw.isString() && raw.text().find('\\') != std::string_view::npos) {
+                _pinned.emplace_front(raw.parse(_resource));
+                return _pinned.front().template to<T>();
+            }
+        }
+        return raw.parse(_resource).template to<T>();
+    }
+    return std::move((*_array)[index]).template to<T>();
+}
+
+} // detail
+} // trpc
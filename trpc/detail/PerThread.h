@@ -0,0 +1,55 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+namespace trpc {
+namespace detail {
+
+// one T per thread, written by its thread without locks,
+// and all of them can be visited by any thread
+//
+// an instance outlives its thread, so what it recorded is kept
+template <typename T>
+class PerThread {
+public:
+    // instance of current thread, created on first use
+    static T& local();
+
+    // instances of all threads, including exited ones
+    static std::vector<std::shared_ptr<T>> all();
+
+private:
+    struct Registry {
+        std::mutex                      mutex;
+        std::vector<std::shared_ptr<T>> instances;
+    };
+    static Registry& registry();
+};
+
+template <typename T>
+inline T& PerThread<T>::local() {
+    static thread_local std::shared_ptr<T> instance = [] {
+        auto instance = std::make_shared<T>();
+        auto &r = registry();
+        std::lock_guard<std::mutex> _ {r.mutex};
+        r.instances.emplace_back(instance);
+        return instance;
+    }();
+    return *instance;
+}
+
+template <typename T>
+inline std::vector<std::shared_ptr<T>> PerThread<T>::all() {
+    auto &r = registry();
+    std::lock_guard<std::mutex> _ {r.mutex};
+    return r.instances;
+}
+
+template <typename T>
+inline typename PerThread<T>::Registry& PerThread<T>::registry() {
+    static Registry r;
+    return r;
+}
+
+} // detail
+} // trpc
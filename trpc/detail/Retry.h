@@ -0,0 +1,105 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <optional>
+#include <vector>
+namespace trpc {
+namespace detail {
+
+// token bucket for retries
+//
+// every call deposits `ratio` token, every retry withdraws one,
+// the reserve bucket is refilled by `reserve` tokens per second
+class RetryBudget {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    RetryBudget() = default;
+    RetryBudget(double ratio, size_t reserve)
+        : _ratio(ratio),
+          // credit of about the last 100 calls
+          _cap(std::max(1.0, ratio * 100)),
+          _reserve(reserve),
+          _reserveBalance(reserve),
+          _refilled(Clock::now())
+    {}
+
+    void deposit() { _balance = std::min(_balance + _ratio, _cap); }
+
+    // false if out of budget
+    bool withdraw();
+
+    // a withdrawal which is not spent after all (a backup request dropped before sent)
+    void refund() { _balance = std::min(_balance + 1, _cap); }
+
+private:
+    double            _ratio {};
+    double            _cap {};
+    double            _balance {};
+    double            _reserve {};
+    double            _reserveBalance {};
+    Clock::time_point _refilled {};
+};
+
+// latency of the last `N` successful calls
+class LatencyWindow {
+public:
+    using Duration = std::chrono::steady_clock::duration;
+
+    // percentiles are not trusted until then
+    constexpr static size_t MIN_SAMPLES = 16;
+
+    void add(Duration latency);
+
+    // p in [0, 1], nullopt if too few samples
+    std::optional<Duration> percentile(double p);
+
+private:
+    constexpr static size_t N = 128;
+    // sorted again after this many samples
+    constexpr static size_t STALE = 16;
+
+    std::array<Duration, N> _samples {};
+    std::vector<Duration>   _sorted;
+    size_t                  _count {};
+    size_t                  _stale {};
+};
+
+inline bool RetryBudget::withdraw() {
+    if(_balance >= 1) {
+        _balance -= 1;
+        return true;
+    }
+    auto now = Clock::now();
+    std::chrono::duration<double> elapsed = now - _refilled;
+    _refilled = now;
+    _reserveBalance = std::min(_reserve, _reserveBalance + _reserve * elapsed.count());
+    if(_reserveBalance >= 1) {
+        _reserveBalance -= 1;
+        return true;
+    }
+    return false;
+}
+
+inline void LatencyWindow::add(Duration latency) {
+    _samples[_count++ % N] = latency;
+    _stale++;
+}
+
+inline std::optional<LatencyWindow::Duration> LatencyWindow::percentile(double p) {
+    size_t size = std::min(_count, N);
+    if(size < MIN_SAMPLES) return std::nullopt;
+    if(_sorted.empty() || _stale >= STALE) {
+        _sorted.assign(_samples.begin(), _samples.begin() + size);
+        std::sort(_sorted.begin(), _sorted.end());
+        _stale = 0;
+    }
+    size_t index = std::clamp(p, 0.0, 1.0) * (_sorted.size() - 1);
+    return _sorted[index];
+}
+
+} // detail
+} // trpc
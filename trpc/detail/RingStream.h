@@ -0,0 +1,371 @@
+#pragma once
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include "co.hpp"
+namespace trpc {
+namespace detail {
+
+// one end of a shared memory connection between two processes on the same host
+//
+// the segment is a memfd mapped by both ends, with a SPSC byte ring in each direction,
+// so a frame is copied once by the writer and once by the reader, without any syscall
+//
+// a waiting end spins for a while (the budget adapts to how often it pays off),
+// then sleeps on its eventfd in co::poll like on a socket, and the other end writes
+// to that eventfd only if it is actually asleep
+// Note: other coroutines of the thread don't run while it spins
+//
+// the segment and eventfds are passed over a connected AF_UNIX socket (SCM_RIGHTS),
+// which is kept open to detect a dead peer (the socket is not owned by the stream)
+class RingStream {
+public:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    // bytes of each ring
+    constexpr static size_t CAPACITY = 1 << 18;
+
+    // server side: create a segment and send it over `socket`
+    // nullptr if failed, see errno
+    static std::unique_ptr<RingStream> offer(int socket, TimePoint deadline);
+
+    // client side: receive the segment from `socket`
+    static std::unique_ptr<RingStream> accept(int socket, TimePoint deadline);
+
+    // the same as detail::bestEffortRead() and detail::bestEffortWrite()
+    // (-1 or the bytes done, ETIMEDOUT, 0 with errno 0 if the peer is closed)
+    ssize_t read(void *buf, size_t least, size_t most, TimePoint deadline);
+    ssize_t write(const void *buf, size_t size, TimePoint deadline);
+
+    // wait for the first byte
+    bool pending(TimePoint deadline);
+
+    // a byte can be read (or the peer is closed) without waiting
+    bool readable() const;
+
+    RingStream(const RingStream&) = delete;
+    RingStream& operator=(const RingStream&) = delete;
+    ~RingStream();
+
+private:
+    struct alignas(64) Ring {
+        // consumed, written by reader
+        alignas(64) std::atomic<uint64_t> head;
+        // produced, written by writer
+        alignas(64) std::atomic<uint64_t> tail;
+        // asleep on its eventfd, waiting for data (reader) or space (writer)
+        alignas(64) std::atomic<uint32_t> readerWaiting;
+        std::atomic<uint32_t>             writerWaiting;
+        std::atomic<uint32_t>             readerClosed;
+        std::atomic<uint32_t>             writerClosed;
+    };
+
+    struct Segment {
+        uint32_t magic;
+        uint32_t capacity;
+        // 0: client -> server, 1: server -> client
+        Ring     rings[2];
+    };
+
+    constexpr static uint32_t MAGIC = 0x74727063;
+    constexpr static size_t SEGMENT_SIZE = sizeof(Segment) + 2 * CAPACITY;
+
+    // adaptive spinning, in polls of the ring
+    // the first polls are busy (the peer runs on another core),
+    // then each poll yields the core (the peer may be waiting for it)
+    constexpr static uint32_t MIN_SPIN = 64;
+    constexpr static uint32_t MAX_SPIN = 1 << 10;
+    constexpr static uint32_t BUSY_SPIN = 32;
+
+    // `wake` is mine, `peerWake` is the peer's
+    RingStream(void *segment, int socket, int wake, int peerWake, bool server);
+
+    // wait until `ready()` or the deadline (false), `flag` is set while asleep
+    template <typename Ready>
+    bool wait(std::atomic<uint32_t> &flag, Ready &&ready, TimePoint deadline);
+
+    // wake the peer if it is asleep on `flag`
+    void wake(std::atomic<uint32_t> &flag);
+
+    bool peerClosed() const;
+
+    static void relax();
+
+private:
+    Segment *_segment;
+    // I write to _tx, and read from _rx
+    Ring    *_tx;
+    Ring    *_rx;
+    char    *_txData;
+    char    *_rxData;
+    int      _socket;
+    int      _wake;
+    int      _peerWake;
+    uint32_t _spin {MIN_SPIN};
+    // the socket is closed by peer (or it crashed)
+    bool     _hangup {};
+};
+
+inline std::unique_ptr<RingStream> RingStream::offer(int socket, TimePoint deadline) {
+    int fds[3] {-1, -1, -1};
+    void *segment = MAP_FAILED;
+    auto fail = [&] {
+        int saved = errno;
+        for(int fd : fds) if(fd >= 0) ::close(fd);
+        if(segment != MAP_FAILED) ::munmap(segment, SEGMENT_SIZE);
+        errno = saved;
+        return nullptr;
+    };
+    fds[0] = ::memfd_create("trpc", MFD_CLOEXEC);
+    if(fds[0] < 0 || ::ftruncate(fds[0], SEGMENT_SIZE)) return fail();
+    for(int i : {1, 2}) {
+        fds[i] = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(fds[i] < 0) return fail();
+    }
+    segment = ::mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    if(segment == MAP_FAILED) return fail();
+    // zero filled by ftruncate
+    auto header = static_cast<Segment*>(segment);
+    header->capacity = CAPACITY;
+    header->magic = MAGIC;
+
+    char byte = 0;
+    iovec iov {&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof fds)] {};
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof fds);
+    ::memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+    while(::sendmsg(socket, &msg, MSG_NOSIGNAL) != 1) {
+        auto remain = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if(errno != EAGAIN && errno != EINTR) return fail();
+        pollfd pfd {socket, POLLOUT, 0};
+        if(remain <= 0 || co::poll(&pfd, 1, std::min<decltype(remain)>(remain, INT_MAX)) == 0) {
+            errno = ETIMEDOUT;
+            return fail();
+        }
+    }
+    // the peer has its own copy
+    ::close(fds[0]);
+    return std::unique_ptr<RingStream>(new RingStream(segment, socket, fds[1], fds[2], true));
+}
+
+inline std::unique_ptr<RingStream> RingStream::accept(int socket, TimePoint deadline) {
+    int fds[3] {-1, -1, -1};
+    char byte;
+    iovec iov {&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof fds)] {};
+    msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    ssize_t ret;
+    while((ret = ::recvmsg(socket, &msg, MSG_CMSG_CLOEXEC)) < 0) {
+        auto remain = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if(errno != EAGAIN && errno != EINTR) return nullptr;
+        pollfd pfd {socket, POLLIN, 0};
+        if(remain <= 0 || co::poll(&pfd, 1, std::min<decltype(remain)>(remain, INT_MAX)) == 0) {
+            errno = ETIMEDOUT;
+            return nullptr;
+        }
+    }
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    if(ret != 1 || !cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof fds)) {
+        // not a shared memory server
+        errno = EPROTO;
+        return nullptr;
+    }
+    ::memcpy(fds, CMSG_DATA(cmsg), sizeof fds);
+    struct stat st;
+    void *segment = MAP_FAILED;
+    if(!::fstat(fds[0], &st) && size_t(st.st_size) == SEGMENT_SIZE) {
+        segment = ::mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    }
+    ::close(fds[0]);
+    if(segment == MAP_FAILED || static_cast<Segment*>(segment)->magic != MAGIC
+            || static_cast<Segment*>(segment)->capacity != CAPACITY) {
+        if(segment != MAP_FAILED) ::munmap(segment, SEGMENT_SIZE);
+        ::close(fds[1]);
+        ::close(fds[2]);
+        errno = EPROTO;
+        return nullptr;
+    }
+    return std::unique_ptr<RingStream>(new RingStream(segment, socket, fds[2], fds[1], false));
+}
+
+inline RingStream::RingStream(void *segment, int socket, int wake, int peerWake, bool server)
+    : _segment(static_cast<Segment*>(segment)),
+      _tx(&_segment->rings[server]),
+      _rx(&_segment->rings[!server]),
+      _txData(reinterpret_cast<char*>(_segment + 1) + CAPACITY * server),
+      _rxData(reinterpret_cast<char*>(_segment + 1) + CAPACITY * !server),
+      _socket(socket),
+      _wake(wake),
+      _peerWake(peerWake)
+{}
+
+inline RingStream::~RingStream() {
+    _tx->writerClosed.store(1, std::memory_order_release);
+    _rx->readerClosed.store(1, std::memory_order_release);
+    // whatever it is waiting for, it should know
+    uint64_t one = 1;
+    ssize_t _ = ::write(_peerWake, &one, sizeof one);
+    (void)_;
+    ::close(_peerWake);
+    ::close(_wake);
+    ::munmap(_segment, SEGMENT_SIZE);
+}
+
+inline ssize_t RingStream::read(void *buf, size_t least, size_t most, TimePoint deadline) {
+    size_t offset = 0;
+    while(offset < least) {
+        uint64_t head = _rx->head.load(std::memory_order_relaxed);
+        uint64_t tail = _rx->tail.load(std::memory_order_acquire);
+        if(head == tail) {
+            if(_rx->writerClosed.load(std::memory_order_acquire) || _hangup) {
+                // FIN
+                errno = 0;
+                return offset;
+            }
+            auto ready = [this, head] {
+                return _rx->tail.load(std::memory_order_acquire) != head
+                    || _rx->writerClosed.load(std::memory_order_acquire);
+            };
+            if(!wait(_rx->readerWaiting, ready, deadline)) break;
+            continue;
+        }
+        size_t n = std::min<size_t>(tail - head, most - offset);
+        size_t at = head % CAPACITY;
+        size_t first = std::min(n, CAPACITY - at);
+        ::memcpy(static_cast<char*>(buf) + offset, _rxData + at, first);
+        ::memcpy(static_cast<char*>(buf) + offset + first, _rxData, n - first);
+        _rx->head.store(head + n, std::memory_order_release);
+        wake(_rx->writerWaiting);
+        offset += n;
+    }
+    if(offset >= least) return offset;
+    errno = ETIMEDOUT;
+    return offset == 0 ? -1 : offset;
+}
+
+inline ssize_t RingStream::write(const void *buf, size_t size, TimePoint deadline) {
+    size_t offset = 0;
+    while(offset < size) {
+        if(_tx->readerClosed.load(std::memory_order_acquire) || _hangup) {
+            errno = EPIPE;
+            return -1;
+        }
+        uint64_t tail = _tx->tail.load(std::memory_order_relaxed);
+        uint64_t head = _tx->head.load(std::memory_order_acquire);
+        if(tail - head == CAPACITY) {
+            auto ready = [this, tail] {
+                return tail - _tx->head.load(std::memory_order_acquire) < CAPACITY
+                    || _tx->readerClosed.load(std::memory_order_acquire);
+            };
+            if(!wait(_tx->writerWaiting, ready, deadline)) break;
+            continue;
+        }
+        size_t n = std::min<size_t>(CAPACITY - (tail - head), size - offset);
+        size_t at = tail % CAPACITY;
+        size_t first = std::min(n, CAPACITY - at);
+        ::memcpy(_txData + at, static_cast<const char*>(buf) + offset, first);
+        ::memcpy(_txData, static_cast<const char*>(buf) + offset + first, n - first);
+        _tx->tail.store(tail + n, std::memory_order_release);
+        wake(_tx->readerWaiting);
+        offset += n;
+    }
+    if(offset >= size) return offset;
+    errno = ETIMEDOUT;
+    return offset == 0 ? -1 : offset;
+}
+
+inline bool RingStream::pending(TimePoint deadline) {
+    auto ready = [this] {
+        return _rx->tail.load(std::memory_order_acquire) != _rx->head.load(std::memory_order_relaxed)
+            || _rx->writerClosed.load(std::memory_order_acquire);
+    };
+    if(readable()) return true;
+    if(wait(_rx->readerWaiting, ready, deadline)) return true;
+    errno = ETIMEDOUT;
+    return false;
+}
+
+inline bool RingStream::readable() const {
+    return _rx->tail.load(std::memory_order_acquire) != _rx->head.load(std::memory_order_relaxed)
+        || _rx->writerClosed.load(std::memory_order_acquire)
+        || _hangup;
+}
+
+template <typename Ready>
+inline bool RingStream::wait(std::atomic<uint32_t> &flag, Ready &&ready, TimePoint deadline) {
+    for(uint32_t i = 0; i < _spin; ++i) {
+        if(ready()) {
+            _spin = std::min(_spin * 2, MAX_SPIN);
+            return true;
+        }
+        i < BUSY_SPIN ? relax() : (void)::sched_yield();
+    }
+    _spin = std::max(_spin / 2, MIN_SPIN);
+    while(1) {
+        // pairs with the fence in wake()
+        flag.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(ready()) {
+            flag.store(0, std::memory_order_relaxed);
+            return true;
+        }
+        auto remain = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if(remain <= 0) {
+            flag.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        pollfd fds[2] {{_wake, POLLIN, 0}, {_socket, POLLIN, 0}};
+        int ret = co::poll(fds, 2, std::min<decltype(remain)>(remain, INT_MAX));
+        flag.store(0, std::memory_order_relaxed);
+        uint64_t count;
+        ssize_t _ = ::read(_wake, &count, sizeof count);
+        (void)_;
+        // nothing is sent on the socket after the handshake, so it is EOF
+        if(ret > 0 && fds[1].revents) {
+            _hangup = true;
+            return true;
+        }
+        if(ready()) return true;
+    }
+}
+
+inline void RingStream::wake(std::atomic<uint32_t> &flag) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!flag.load(std::memory_order_relaxed)) return;
+    uint64_t one = 1;
+    ssize_t _ = ::write(_peerWake, &one, sizeof one);
+    (void)_;
+}
+
+inline void RingStream::relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+} // detail
+} // trpc
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "vsjson.hpp"
+#include "Outbound.h"
+namespace trpc {
+namespace detail {
+
+// per-connection memory of a server
+// json trees of a request live in `arena`, the response frames in `outbound`
+struct Scratch {
+    vsjson::Arena arena;
+    Outbound      outbound;
+};
+
+// scratches of closed connections are reused by new ones in the same thread,
+// so neither a request nor a reconnect allocates in steady state
+class ScratchPool {
+public:
+    // kept at most
+    constexpr static size_t CAPACITY = 64;
+    // a larger outbound buffer (for a large response) is not kept
+    constexpr static size_t MAX_OUTPUT = 1 << 16;
+
+    // pool of current thread
+    static ScratchPool& local();
+
+    std::unique_ptr<Scratch> acquire();
+    void release(std::unique_ptr<Scratch> scratch);
+
+    ScratchPool() { _free.reserve(CAPACITY); }
+
+private:
+    std::vector<std::unique_ptr<Scratch>> _free;
+};
+
+inline ScratchPool& ScratchPool::local() {
+    static thread_local ScratchPool pool;
+    return pool;
+}
+
+inline std::unique_ptr<Scratch> ScratchPool::acquire() {
+    if(_free.empty()) {
+        auto scratch = std::make_unique<Scratch>();
+        scratch->outbound.reserve(vsjson::Arena::DEFAULT_BLOCK_SIZE);
+        return scratch;
+    }
+    auto scratch = std::move(_free.back());
+    _free.pop_back();
+    return scratch;
+}
+
+inline void ScratchPool::release(std::unique_ptr<Scratch> scratch) {
+    if(_free.size() >= CAPACITY || scratch->outbound.capacity() > MAX_OUTPUT) return;
+    scratch->arena.reset();
+    scratch->outbound.clear();
+    _free.emplace_back(std::move(scratch));
+}
+
+} // detail
+} // trpc
@@ -3,59 +3,176 @@
 #include <poll.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <climits>
 #include <cstddef>
+#include <algorithm>
 #include <chrono>
 #include "co.hpp"
 namespace trpc {
 namespace detail {
 
 using Milliseconds = std::chrono::milliseconds;
+using TimePoint = std::chrono::steady_clock::time_point;
 
-ssize_t bestEffortRead(int fd, const void *buf, size_t size, Milliseconds timeout, size_t maxRetries);
-ssize_t bestEffortWrite(int fd, const void *buf, size_t size, Milliseconds timeout, size_t maxRetries);
+// read or write `size` bytes before `deadline`
+// -1 if failed (ETIMEDOUT if nothing is done in time), or else the bytes done
+ssize_t bestEffortRead(int fd, const void *buf, size_t size, TimePoint deadline);
+ssize_t bestEffortWrite(int fd, const void *buf, size_t size, TimePoint deadline);
+
+// read at least `least` bytes and at most `most` bytes before `deadline`
+// the same return value as bestEffortRead()
+ssize_t bestEffortReadSome(int fd, void *buf, size_t least, size_t most, TimePoint deadline);
+
+// gather `count` buffers into as few writes as possible (usually one)
+// `iov` is consumed as it is written, the same return value as bestEffortWrite()
+ssize_t bestEffortWritev(int fd, iovec *iov, int count, TimePoint deadline);
+
+// TCP_NODELAY for a TCP socket, nothing for other families
+// frames are coalesced before they are written, so Nagle's algorithm only adds delay
+// false if failed, see errno
+bool noDelay(int fd, int family);
+
+template <typename CoPosixFunc>
+ssize_t bestEffortTemplate(CoPosixFunc func, int event,
+    int fd, const void *buf, size_t size, TimePoint deadline);
 
 template <typename CoPosixFunc>
 ssize_t bestEffortTemplate(CoPosixFunc func, int event,
-    int fd, const void *buf, size_t size, Milliseconds timeout, size_t maxRetries);
+    int fd, const void *buf, size_t least, size_t most, TimePoint deadline);
+
+// a connected socket as a byte stream of the server, see also detail::RingStream
+struct SocketStream {
+    int fd;
+
+    // the same as bestEffortReadSome() and bestEffortWrite()
+    ssize_t read(void *buf, size_t least, size_t most, TimePoint deadline);
+    ssize_t write(const void *buf, size_t size, TimePoint deadline);
+
+    // wait for the first byte (not read)
+    bool pending(TimePoint deadline);
+
+    // a byte (or FIN) can be read without waiting
+    bool readable();
+};
+
 
 
 
 
 
+inline ssize_t bestEffortRead(int fd, const void *buf, size_t size, TimePoint deadline) {
+    return bestEffortTemplate(co::read, POLLIN, fd, buf, size, deadline);
+}
+
+inline ssize_t bestEffortWrite(int fd, const void *buf, size_t size, TimePoint deadline) {
+    return bestEffortTemplate(co::write, POLLOUT, fd, buf, size, deadline);
+}
+
+inline ssize_t bestEffortReadSome(int fd, void *buf, size_t least, size_t most, TimePoint deadline) {
+    return bestEffortTemplate(co::read, POLLIN, fd, buf, least, most, deadline);
+}
+
+inline ssize_t bestEffortWritev(int fd, iovec *iov, int count, TimePoint deadline) {
+    size_t offset = 0;
+    while(count > 0) {
+        auto remain = std::chrono::ceil<Milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if(remain <= 0) {
+            break;
+        }
+        // try first, a socket is rarely full
+        ssize_t ret = ::writev(fd, iov, count);
+        if(ret < 0) switch(errno) {
+            case EINTR:
+                continue;
+            case EAGAIN:
+            {
+                pollfd pfd {fd, POLLOUT, 0};
+                if(co::poll(&pfd, 1, std::min<decltype(remain)>(remain, INT_MAX)) < 0 && errno != EINTR) {
+                    return -1;
+                }
+                continue;
+            }
+            default:
+                return -1;
+        }
+        offset += ret;
+        // skip what is written
+        size_t n = ret;
+        while(count > 0 && n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if(count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+    if(count == 0) {
+        return offset;
+    }
+    errno = ETIMEDOUT;
+    return offset == 0 ? -1 : offset;
+}
+
+inline bool noDelay(int fd, int family) {
+    if(family != AF_INET && family != AF_INET6) return true;
+    int opt = 1;
+    return !::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, static_cast<socklen_t>(sizeof opt));
+}
+
+inline ssize_t SocketStream::read(void *buf, size_t least, size_t most, TimePoint deadline) {
+    return bestEffortReadSome(fd, buf, least, most, deadline);
+}
+
+inline ssize_t SocketStream::write(const void *buf, size_t size, TimePoint deadline) {
+    return bestEffortWrite(fd, buf, size, deadline);
+}
 
+inline bool SocketStream::pending(TimePoint deadline) {
+    constexpr static ssize_t FIRST_BYTE = 1;
+    auto hook = [](int, const void *, size_t /*same as return value*/) {
+        return FIRST_BYTE;
+    };
+    // internal poll mode must be LT
+    // because we don't actually read 1 byte
+    return bestEffortTemplate(hook, POLLIN, fd, nullptr, FIRST_BYTE, deadline) == FIRST_BYTE;
+}
 
-inline ssize_t bestEffortRead(int fd, const void *buf, size_t size, Milliseconds timeout, size_t maxRetries) {
-    return bestEffortTemplate(co::read, POLLIN, fd, buf, size, timeout, maxRetries);
+inline bool SocketStream::readable() {
+    pollfd pfd {fd, POLLIN, 0};
+    return ::poll(&pfd, 1, 0) > 0;
 }
 
-inline ssize_t bestEffortWrite(int fd, const void *buf, size_t size, Milliseconds timeout, size_t maxRetries) {
-    return bestEffortTemplate(co::write, POLLOUT, fd, buf, size, timeout, maxRetries);
+template <typename CoPosixFunc>
+inline ssize_t bestEffortTemplate(CoPosixFunc func, int event, int fd, const void *buf, size_t size, TimePoint deadline) {
+    return bestEffortTemplate(func, event, fd, buf, size, size, deadline);
 }
 
 template <typename CoPosixFunc>
-inline ssize_t bestEffortTemplate(CoPosixFunc func, int event, int fd, const void *buf, size_t size, Milliseconds timeout, size_t maxRetries) {
-    auto tick = [] { return std::chrono::steady_clock::now(); };
-    auto start = tick();
-    size_t retries = 0;
+inline ssize_t bestEffortTemplate(CoPosixFunc func, int event, int fd, const void *buf,
+                                  size_t least, size_t most, TimePoint deadline) {
     size_t offset = 0;
-    int interval = timeout.count() / maxRetries;
-    while(retries++ < maxRetries) {
-        if(tick() - start > timeout) {
-            errno = ETIMEDOUT;
-            return -1;
+    while(offset < least) {
+        // poll for the whole remaining budget, not in slices
+        auto remain = std::chrono::ceil<Milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if(remain <= 0) {
+            break;
         }
 
         pollfd pfd {};
         pfd.fd = fd;
         pfd.events = event;
         int pret;
-        if((pret = co::poll(&pfd, 1, interval)) <= 0) {
-            if(pret < 0) return -1;
+        if((pret = co::poll(&pfd, 1, std::min<decltype(remain)>(remain, INT_MAX))) <= 0) {
+            if(pret < 0 && errno != EINTR) return -1;
             continue;
         }
 
-        ssize_t ret = func(fd, (char*)(buf) + offset, size - offset);
+        ssize_t ret = func(fd, (char*)(buf) + offset, most - offset);
 
         if(ret < 0) switch(errno) {
             // interrupted
@@ -75,19 +192,17 @@ inline ssize_t bestEffortTemplate(CoPosixFunc func, int event, int fd, const voi
         }
         // FIN
         if(ret == 0) {
+            errno = 0;
             return offset;
         }
         offset += ret;
-        if(offset == size) {
-            return size;
-        }
     }
-    // upper layer error
-    if(offset == 0) {
-        errno = ETIMEDOUT;
-        return -1;
+    if(offset >= least) {
+        return offset;
     }
-    return offset;
+    // upper layer error
+    errno = ETIMEDOUT;
+    return offset == 0 ? -1 : offset;
 }
 
 } // detail
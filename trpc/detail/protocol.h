@@ -14,6 +14,8 @@ struct Field {
     constexpr static char id[]      {"id"};
     constexpr static char code[]    {"code"};
     constexpr static char message[] {"message"};
+    // extension: remaining budget of the call in milliseconds
+    constexpr static char timeout[] {"timeout"};
 };
 
 struct Attribute {
@@ -23,12 +25,26 @@ struct Attribute {
     constexpr static int methodNotFoundCode {-32601};
     constexpr static int invalidParamsCode {-32602};
     constexpr static int internalErrorCode {-32603};
+    // -32000 to -32099 are reserved for implementation-defined server errors
+    constexpr static int overloadedCode {-32000};
+    constexpr static int deadlineExceededCode {-32001};
 
     constexpr static char parseError[] {"Parse error"};
     constexpr static char invalidRequest[] {"Invalid Request"};
     constexpr static char methodNotFound[] {"Method not found"};
     constexpr static char invalidParams[] {"Invalid params"};
     constexpr static char internalError[] {"Internal error"};
+    constexpr static char overloaded[] {"Server overloaded"};
+    constexpr static char deadlineExceeded[] {"Deadline exceeded"};
+};
+
+// methods reserved by server, JSON-RPC reserves names beginning with "rpc."
+struct Builtin {
+    constexpr static char prefix[]  {"rpc."};
+    // result: bound method names, the index of each one is its method id
+    constexpr static char methods[] {"rpc.methods"};
+    // result: metrics of this process, see trpc::Stats::report()
+    constexpr static char stats[]   {"rpc.stats"};
 };
 
 class Exception: public std::exception {
@@ -48,6 +64,12 @@ public:
     static Exception makeInternalErrorException() {
         return {Attribute::internalErrorCode, Attribute::internalError};
     }
+    static Exception makeOverloadedException() {
+        return {Attribute::overloadedCode, Attribute::overloaded};
+    }
+    static Exception makeDeadlineExceededException() {
+        return {Attribute::deadlineExceededCode, Attribute::deadlineExceeded};
+    }
 
 public:
     explicit Exception(int code): _code(code) {}
@@ -73,6 +95,7 @@ constexpr char Field::error[];
 constexpr char Field::id[];
 constexpr char Field::code[];
 constexpr char Field::message[];
+constexpr char Field::timeout[];
 
 
 constexpr char Attribute::version[];
@@ -81,6 +104,12 @@ constexpr char Attribute::invalidRequest[];
 constexpr char Attribute::methodNotFound[];
 constexpr char Attribute::invalidParams[];
 constexpr char Attribute::internalError[];
+constexpr char Attribute::overloaded[];
+constexpr char Attribute::deadlineExceeded[];
+
+constexpr char Builtin::prefix[];
+constexpr char Builtin::methods[];
+constexpr char Builtin::stats[];
 
 } // protocol
 } // detail
@@ -11,8 +11,13 @@ namespace detail {
 
 /// request
 
+// method: name or method id
 template <typename ...Args>
-vsjson::Json makeRequest(int token, const std::string &method, Args &&...params);
+vsjson::Json makeRequest(int token, vsjson::Json method, Args &&...params);
+
+// request without id, server never replies
+template <typename ...Args>
+vsjson::Json makeNotification(vsjson::Json method, Args &&...params);
 
 template <typename Arg, typename ...Args>
 void makeRequestImpl(vsjson::Json &json, Arg &&arg, Args &&...args);
@@ -24,6 +29,12 @@ void makeRequestImpl(vsjson::Json &json, Args &&...args);
 
 vsjson::Json makeEmptyResponse(vsjson::Json &request);
 
+// id is null, used when the request id is unknown
+vsjson::Json makeEmptyResponse();
+
+// only `id` is parsed
+vsjson::Json makeEmptyResponse(const vsjson::LazyObject &request, vsjson::Resource *resource = nullptr);
+
 /// result
 
 template <typename T>
@@ -31,14 +42,29 @@ std::optional<T> makeResult(vsjson::Json &response);
 
 
 template <typename ...Args>
-inline vsjson::Json makeRequest(int token, const std::string &method, Args &&...params) {
+inline vsjson::Json makeRequest(int token, vsjson::Json method, Args &&...params) {
     vsjson::Json json =
     {
         {protocol::Field::jsonrpc, protocol::Attribute::version},
         {protocol::Field::id, token},
-        {protocol::Field::method, method},
+        {protocol::Field::method, nullptr},
+        {protocol::Field::params, vsjson::Json::array()}
+    };
+    json[protocol::Field::method] = std::move(method);
+    vsjson::Json &argsJson = json[protocol::Field::params];
+    makeRequestImpl(argsJson, std::forward<Args>(params)...);
+    return json;
+}
+
+template <typename ...Args>
+inline vsjson::Json makeNotification(vsjson::Json method, Args &&...params) {
+    vsjson::Json json =
+    {
+        {protocol::Field::jsonrpc, protocol::Attribute::version},
+        {protocol::Field::method, nullptr},
         {protocol::Field::params, vsjson::Json::array()}
     };
+    json[protocol::Field::method] = std::move(method);
     vsjson::Json &argsJson = json[protocol::Field::params];
     makeRequestImpl(argsJson, std::forward<Args>(params)...);
     return json;
@@ -57,11 +83,33 @@ inline vsjson::Json makeEmptyResponse(vsjson::Json &request) {
     vsjson::Json response =
     {
         {detail::protocol::Field::jsonrpc, detail::protocol::Attribute::version},
-        {detail::protocol::Field::id, request[detail::protocol::Field::id].to<int>()},
+        // echo the id as it is, it may be any 64-bit integer or even a string
+        {detail::protocol::Field::id, request[detail::protocol::Field::id]},
+    };
+    return response;
+}
+
+inline vsjson::Json makeEmptyResponse() {
+    vsjson::Json response =
+    {
+        {detail::protocol::Field::jsonrpc, detail::protocol::Attribute::version},
+        {detail::protocol::Field::id, nullptr},
     };
     return response;
 }
 
+inline vsjson::Json makeEmptyResponse(const vsjson::LazyObject &request, vsjson::Resource *resource) {
+    auto id = request.find(detail::protocol::Field::id);
+    // allocated from `resource` as well, the result is inserted later
+    vsjson::ObjectImpl::allocator_type allocator {resource};
+    vsjson::ObjectImpl response {allocator};
+    response.try_emplace(vsjson::detail::String(detail::protocol::Field::jsonrpc, allocator),
+                         vsjson::StringViewImpl(detail::protocol::Attribute::version));
+    response.try_emplace(vsjson::detail::String(detail::protocol::Field::id, allocator),
+                         id ? id->parse(resource) : nullptr);
+    return vsjson::Json(std::move(response));
+}
+
 template <typename T>
 inline std::optional<T> makeResult(vsjson::Json &response) {
     if(!response.contains(protocol::Field::error)) {